@@ -0,0 +1,48 @@
+#pragma once
+
+#include "precompiled.h"
+
+namespace ATL24_coastnet
+{
+
+// Allocator that aligns its blocks to 'A' bytes
+//
+// For example, 'std::vector<uint8_t, aligned_allocator<uint8_t, 64>>'
+// starts on a cache line.
+template<typename T, size_t A>
+struct aligned_allocator
+{
+    static_assert (A >= alignof (T), "Alignment is too small");
+    static_assert ((A & (A - 1)) == 0, "Alignment must be a power of 2");
+
+    using value_type = T;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = aligned_allocator<U, A>;
+    };
+
+    aligned_allocator () = default;
+    template<typename U>
+    aligned_allocator (const aligned_allocator<U, A> &)
+    {
+    }
+
+    T *allocate (const size_t n)
+    {
+        return static_cast<T *> (::operator new (n * sizeof (T), std::align_val_t (A)));
+    }
+    void deallocate (T *p, const size_t)
+    {
+        ::operator delete (p, std::align_val_t (A));
+    }
+
+    template<typename U>
+    bool operator== (const aligned_allocator<U, A> &) const
+    {
+        return true;
+    }
+};
+
+} // namespace ATL24_coastnet
@@ -260,8 +260,129 @@ T bathy_range_check (T p, const double range)
     return p;
 }
 
+// Photons binned on a uniform (x, z) grid
+//
+// The cells are a little larger than 'radius', so that rounding can't
+// put two photons that are within 'radius' of each other more than one
+// cell apart, and a photon's neighbors are all in the 3x3 block of
+// cells around it.
+class photon_grid
+{
+    public:
+    // 'x' must be sorted
+    template<typename X, typename Z>
+    photon_grid (const std::vector<X> &x,
+        const std::vector<Z> &z,
+        const double radius)
+        : cell_size (radius * 1.01)
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (x.size () == z.size ());
+        assert (radius > 0.0);
+        assert (is_sorted (x.begin (), x.end ()));
+
+        if (x.empty ())
+            return;
+
+        const double x0 = x.front ();
+        const double z0 = *min_element (z.begin (), z.end ());
+
+        // The photons are sorted by X, so the columns are already in
+        // order
+        entries.resize (x.size ());
+        for (size_t i = 0; i < x.size (); ++i)
+        {
+            entries[i].cx = std::floor ((x[i] - x0) / cell_size);
+            entries[i].cz = std::floor ((z[i] - z0) / cell_size);
+            entries[i].index = i;
+
+            if (columns.empty () || columns.back ().cx != entries[i].cx)
+                columns.push_back ({ entries[i].cx, i, i });
+            ++columns.back ().end;
+        }
+
+        // Sort each column by Z
+        for (const auto &c : columns)
+            sort (entries.begin () + c.begin, entries.begin () + c.end,
+                [](const auto &a, const auto &b)
+                { return a.cz < b.cz; });
+
+        // Remember where each photon went
+        column_indexes.resize (x.size ());
+        for (size_t c = 0; c < columns.size (); ++c)
+            for (size_t j = columns[c].begin; j < columns[c].end; ++j)
+                column_indexes[entries[j].index] = c;
+        cell_zs.resize (x.size ());
+        for (const auto &e : entries)
+            cell_zs[e.index] = e.cz;
+    }
+
+    // Call 'f (j)' for each photon 'j' in the 3x3 block of cells around
+    // photon 'i', starting with the cells in its own column, until 'f'
+    // returns false
+    template<typename F>
+    void visit_neighbors (const size_t i, F f) const
+    {
+        assert (i < column_indexes.size ());
+
+        const size_t c = column_indexes[i];
+        const int64_t cx = columns[c].cx;
+        const int64_t cz = cell_zs[i];
+
+        // Own column, then the columns on either side
+        if (!visit_column (c, cz, f))
+            return;
+        if (c > 0 && columns[c - 1].cx == cx - 1 && !visit_column (c - 1, cz, f))
+            return;
+        if (c + 1 < columns.size () && columns[c + 1].cx == cx + 1)
+            visit_column (c + 1, cz, f);
+    }
+
+    private:
+    struct entry
+    {
+        int64_t cx;
+        int64_t cz;
+        size_t index;
+    };
+    struct column
+    {
+        int64_t cx;
+        size_t begin;
+        size_t end;
+    };
+    const double cell_size;
+    // Photons sorted by cell
+    std::vector<entry> entries;
+    std::vector<column> columns;
+    // Column and Z cell of each photon
+    std::vector<size_t> column_indexes;
+    std::vector<int64_t> cell_zs;
+
+    template<typename F>
+    bool visit_column (const size_t c, const int64_t cz, F &f) const
+    {
+        using namespace std;
+
+        const auto first = entries.begin () + columns[c].begin;
+        const auto last = entries.begin () + columns[c].end;
+
+        // Find the cells from 'cz - 1' to 'cz + 1'
+        auto it = lower_bound (first, last, cz - 1,
+            [](const auto &e, const int64_t z)
+            { return e.cz < z; });
+        for ( ; it != last && it->cz <= cz + 1; ++it)
+            if (!f (it->index))
+                return false;
+
+        return true;
+    }
+};
+
 template<typename T>
-T filter_isolated_bathy (T p,
+void filter_isolated_bathy_in_place (T &p,
     const double isolated_bathy_radius,
     const double isolated_bathy_min_photons)
 {
@@ -269,164 +390,293 @@ T filter_isolated_bathy (T p,
 
     assert (!p.empty ());
 
+    // A photon is always its own neighbor, so the radius must be positive
+    assert (isolated_bathy_radius > 0.0);
+
     // Get indexes of bathy photons
     vector<size_t> indexes;
     for (size_t i = 0; i < p.size (); ++i)
         if (p[i].prediction == bathy_class)
             indexes.push_back (i);
 
-    // For each bathy photon, get left and right window indexes
-    vector<pair<size_t,size_t>> lr_indexes (indexes.size ());
-    for (size_t i = 0; i < lr_indexes.size (); ++i)
+    if (indexes.empty ())
+        return;
+
+    // Copy their locations, keeping the container's precision
+    vector<remove_cvref_t<decltype (p[0].x)>> x (indexes.size ());
+    vector<remove_cvref_t<decltype (p[0].z)>> z (indexes.size ());
+    for (size_t i = 0; i < indexes.size (); ++i)
     {
-        // Get left boundary
-        size_t j1 = i;
-        while (j1 > 0)
-        {
+        x[i] = p[indexes[i]].x;
+        z[i] = p[indexes[i]].z;
+    }
 
-            // Values should be sorted by XATC
-            assert (i < indexes.size ());
-            assert (j1 - 1 < indexes.size ());
-            assert (indexes[i] < p.size ());
-            assert (indexes[j1 - 1] < p.size ());
-            assert (p[indexes[j1 - 1]].x <= p[indexes[i]].x);
+    // Bin them, so each photon only has to look at the photons in the
+    // cells around it
+    const photon_grid grid (x, z, isolated_bathy_radius);
 
-            // Get the distance from 'i' to 'j' along X axis
-            const double dx = p[indexes[i]].x - p[indexes[j1 - 1]].x;
+    const auto distance = [&](const size_t i, const size_t j)
+    {
+        const double dx = fabs (x[i] - x[j]);
+        const double dz = fabs (z[i] - z[j]);
+        return std::sqrt (dx * dx + dz * dz);
+    };
+
+    // A photon is not isolated if enough photons are within the
+    // radius, counting itself
+    //
+    // Stop counting once there are enough.
+    vector<bool> not_isolated (indexes.size ());
+    for (size_t i = 0; i < indexes.size (); ++i)
+    {
+        size_t neighbors = 0;
+        grid.visit_neighbors (i, [&](const size_t j)
+        {
+            // Count it
+            if (distance (i, j) < isolated_bathy_radius)
+                ++neighbors;
 
-            if (dx > isolated_bathy_radius)
-                break;
+            return neighbors < isolated_bathy_min_photons;
+        });
 
-            // Move left
-            --j1;
-        }
+        not_isolated[i] = !(neighbors < isolated_bathy_min_photons);
+    }
 
-        // Get right boundary
-        size_t j2 = i;
-        while (j2 + 1 < lr_indexes.size ())
+    // Photons that are not isolated, and photons that are close enough
+    // to one that is not isolated, stay on
+    for (size_t i = 0; i < indexes.size (); ++i)
+    {
+        bool on = not_isolated[i];
+        if (!on)
         {
+            grid.visit_neighbors (i, [&](const size_t j)
+            {
+                // Is it close enough?
+                if (not_isolated[j] && distance (i, j) <= isolated_bathy_radius)
+                    on = true;
+
+                return !on;
+            });
+        }
 
-            // Values should be sorted by XATC
-            assert (i < indexes.size ());
-            assert (j2 + 1 < indexes.size ());
-            assert (indexes[i] < p.size ());
-            assert (indexes[j2 + 1] < p.size ());
-            assert (p[indexes[i]].x <= p[indexes[j2 + 1]].x);
+        assert (indexes[i] < p.size ());
+        p[indexes[i]].prediction = on ? bathy_class : 0;
+    }
+}
+template<typename T>
+T filter_isolated_bathy (T p,
+    const double isolated_bathy_radius,
+    const double isolated_bathy_min_photons)
+{
+    filter_isolated_bathy_in_place (p, isolated_bathy_radius, isolated_bathy_min_photons);
+    return p;
+}
 
-            // Get the distance from 'i' to 'j' along X axis
-            const double dx = p[indexes[j2 + 1]].x - p[indexes[i]].x;
+} // namespace detail
 
-            if (dx > isolated_bathy_radius)
-                break;
+// Reclassify photons using heuristics, in place
+//
+// This gives the same result as running the stages in 'detail' one
+// after the other:
+//
+//     surface_elevation_check
+//     bathy_elevation_check
+//     bathy_depth_check
+//     surface_range_check
+//     bathy_range_check
+//     filter_isolated_bathy
+//
+// but the per-photon checks are fused, so it makes three passes over
+// the photons instead of six, and no copies:
+//
+//     1. The elevation checks, and the sea surface variance bins that
+//        the depth check needs
+//     2. The depth check and the range checks
+//     3. The isolated bathy filter, which needs each photon's neighbors
+namespace detail
+{
 
-            // Move right
-            ++j2;
+// Sea surface variance bins, see get_quantized_variance ()
+//
+// The bins are 'bin_size' meters wide, starting at 'min_x'. Surface
+// photons are added in order along the track, and the bins grow to
+// hold them.
+class surface_variance_bins
+{
+    public:
+    surface_variance_bins (const double init_bin_size, const unsigned init_min_x)
+        : bin_size (init_bin_size)
+        , min_x (init_min_x)
+    {
+    }
+    size_t get_bin (const double x) const
+    {
+        // Get along-track index
+        const double distance = (x - min_x) / bin_size;
+        assert (distance >= 0.0);
+        const unsigned j = std::floor (distance);
+        return j;
+    }
+    void add (const double x, const double z)
+    {
+        const size_t j = get_bin (x);
+        if (j >= totals.size ())
+        {
+            sums.resize (j + 1);
+            sums2.resize (j + 1);
+            totals.resize (j + 1);
         }
-
-        lr_indexes[i] = make_pair (j1, j2);
+        sums[j] += z;
+        sums2[j] += (z * z);
+        ++totals[j];
     }
-
-    // For each bathy photon, count how many neighbors are within the radius
-    vector<size_t> neighbors (indexes.size ());
-    for (size_t i = 0; i < neighbors.size (); ++i)
+    // Get how far below the surface bathy at 'x' must be, or NaN if
+    // there is no surface there
+    double get_min_depth (const double x, const double depth_factor) const
     {
-        // Get bounding indexes
-        assert (i < lr_indexes.size ());
-        size_t j1 = lr_indexes[i].first;
-        size_t j2 = lr_indexes[i].second;
+        const size_t j = get_bin (x);
+        if (j >= totals.size () || totals[j] == 0)
+            return NAN;
 
-        // For each photon in the window
-        for (size_t j = j1; j <= j2; ++j)
-        {
-            assert (i < indexes.size ());
-            assert (j < indexes.size ());
-            assert (indexes[i] < p.size ());
-            assert (indexes[j] < p.size ());
-            const double dx = fabs (p[indexes[i]].x - p[indexes[j]].x);
-            const double dz = fabs (p[indexes[i]].z - p[indexes[j]].z);
-            const double d = std::sqrt (dx * dx + dz * dz);
+        // E(X) = E(X^2) - E(X)^2
+        const double ex = sums[j] / totals[j];
+        const double ex2 = sums2[j] / totals[j];
 
-            // Count it
-            if (d < isolated_bathy_radius)
-                ++neighbors[i];
-        }
+        // Check for rounding error
+        const double var = ex2 < ex * ex ? 0.0 : ex2 - ex * ex;
 
-        // Note that we always get a count of at least 1 because
-        // the photon at 'i' is 0.0 meters away
-        assert (neighbors[i] >= 1);
+        // See bathy_depth_check ()
+        const double surface_stddev = std::sqrt (var);
+        return depth_factor * surface_stddev > 1.0
+            ? 1.0
+            : depth_factor * surface_stddev;
     }
 
-    // Assume they are all isolated
-    for (size_t i = 0; i < indexes.size (); ++i)
+    private:
+    double bin_size;
+    unsigned min_x;
+    std::vector<double> sums;
+    std::vector<double> sums2;
+    std::vector<double> totals;
+};
+
+// Check the elevation of one surface or bathy photon
+template<typename T,typename U>
+void check_elevation (T &&q, const U &params)
+{
+    if (q.prediction == sea_surface_class)
     {
-        assert (indexes[i] < p.size ());
-        p[indexes[i]].prediction = 0;
+        // Surface photons must be near sea level
+        if (q.z > params.surface_max_elevation)
+            q.prediction = 0;
+        if (q.z < params.surface_min_elevation)
+            q.prediction = 0;
+    }
+    else if (q.prediction == bathy_class)
+    {
+        // Bathy photons can't be too deep
+        if (q.z < params.bathy_min_elevation)
+            q.prediction = 0;
     }
+}
 
-    // Turn back on ones that are not isolated
-    for (size_t i = 0; i < indexes.size (); ++i)
+// Check one surface or bathy photon against the elevation estimates and
+// the sea surface above it
+template<typename T,typename U>
+void check_estimates (T &&q, const surface_variance_bins &bins, const U &params)
+{
+    if (q.prediction == sea_surface_class)
     {
-        if (neighbors[i] < isolated_bathy_min_photons)
-            continue;
+        // Sea surface photons must all be near the elevation estimate
+        const double d = std::fabs (q.z - q.surface_elevation);
+
+        // Must be within +-range
+        if (d > params.surface_range)
+            q.prediction = 0;
+    }
+    else if (q.prediction == bathy_class)
+    {
+        // If there is no sea surface above it, this can't be bathy
+        const double min_depth = bins.get_min_depth (q.x, params.blunder_surface_depth_factor);
+        if (std::isnan (min_depth))
+        {
+            q.prediction = 0;
+            return;
+        }
 
-        // Get bounding indexes
-        assert (i < lr_indexes.size ());
-        size_t j1 = lr_indexes[i].first;
-        size_t j2 = lr_indexes[i].second;
+        // Bathy photons can't be above the sea surface
+        const double bathy_min_depth = q.surface_elevation - min_depth;
 
-        // For each photon in the window
-        for (size_t j = j1; j <= j2; ++j)
+        if (q.z > bathy_min_depth)
         {
-            const double dx = fabs (p[indexes[i]].x - p[indexes[j]].x);
-            const double dz = fabs (p[indexes[i]].z - p[indexes[j]].z);
-            const double d = std::sqrt (dx * dx + dz * dz);
-
-            // Is it close enough?
-            if (d > isolated_bathy_radius)
-                continue;
-
-            // Turn it back on
-            assert (j < indexes.size ());
-            assert (indexes[j] < p.size ());
-            p[indexes[j]].prediction = 40;
+            q.prediction = 0;
+            return;
         }
-    }
 
-    return p;
+        // Bathy photons must all be near the elevation estimate
+        const double d = std::fabs (q.z - q.bathy_elevation);
+
+        // Must be within +-range
+        if (d > params.bathy_range)
+            q.prediction = 0;
+    }
 }
 
 } // namespace detail
 
 template<typename T,typename U>
-T blunder_detection (T p, const U &params)
+void blunder_detection_in_place (T &p, const U &params)
 {
-    // Reclassify photons using heuristics
     using namespace std;
 
     if (p.empty ())
-        return p;
+        return;
 
-    // Surface photons must be near sea level
-    p = detail::surface_elevation_check (p,
-        params.surface_min_elevation,
-        params.surface_max_elevation);
+    // Values should be sorted
+    detail::surface_variance_bins bins (params.blunder_surface_bin_size, p[0].x);
 
-    // Bathy photons can't be too deep
-    p = detail::bathy_elevation_check (p,
-        params.bathy_min_elevation);
+    // Pass 1
+    size_t total_bathy = 0;
+    size_t total_surface = 0;
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        detail::check_elevation (p[i], params);
+
+        // Count what's left
+        if (p[i].prediction == bathy_class)
+        {
+            ++total_bathy;
+        }
+        else if (p[i].prediction == sea_surface_class)
+        {
+            ++total_surface;
+            bins.add (p[i].x, p[i].z);
+        }
+    }
 
-    // Bathy photons can't be above the sea surface
-    p = detail::bathy_depth_check (p, params.blunder_surface_bin_size, params.blunder_surface_depth_factor);
+    // If there is no surface, there can't be any bathy
+    if (total_bathy != 0 && total_surface == 0)
+    {
+        // The depth check reclassifies everything, so the remaining
+        // checks have nothing to do
+        for (size_t i = 0; i < p.size (); ++i)
+            p[i].prediction = 0;
 
-    // Sea surface photons must all be near the elevation estimate
-    p = detail::surface_range_check (p, params.surface_range);
+        return;
+    }
 
-    // Bathy photons must all be near the elevation estimate
-    p = detail::bathy_range_check (p, params.bathy_range);
+    // Pass 2
+    for (size_t i = 0; i < p.size (); ++i)
+        detail::check_estimates (p[i], bins, params);
 
-    // Remove stray bathy photons
-    p = detail::filter_isolated_bathy (p, params.isolated_bathy_radius, params.isolated_bathy_min_photons);
+    // Pass 3, remove stray bathy photons
+    detail::filter_isolated_bathy_in_place (p, params.isolated_bathy_radius, params.isolated_bathy_min_photons);
+}
 
+template<typename T,typename U>
+T blunder_detection (T p, const U &params)
+{
+    blunder_detection_in_place (p, params);
     return p;
 }
 
@@ -3,7 +3,11 @@
 #include "precompiled.h"
 #include "blunder_detection.h"
 #include "confusion.h"
+#include "ordering.h"
+#include "timer.h"
 #include "utils.h"
+#include "quickscorer.h"
+#include "tree_ensemble.h"
 #include "xgboost.h"
 
 namespace ATL24_coastnet
@@ -216,60 +220,121 @@ void interpolate_nans (T &p, const U &n)
     }
 }
 
+// Run a box filter over 'p' in place
+//
+// 'sums' is scratch space, and must be the same size as 'p'.
+//
+// The running sum is kept in order, so the results are the same as
+// summing the window at each point, and the windows that are not
+// clipped by the edges don't need any branches.
 template<typename T>
-T box_filter (const T &p, const int filter_width)
+void box_filter_in_place (T &p, std::vector<double> &sums, const int filter_width)
 {
     // Check invariants
     assert ((filter_width & 1) != 0); // Must be an odd kernel
     assert (filter_width >= 3); // w=1 does not make sense
+    assert (sums.size () == p.size ());
 
-    // Keep cumulative sums and totals across the vector
-    std::vector<double> sums (p.size ());
-    std::vector<size_t> totals (p.size ());
-    double cumulative_sum = 0.0;
-    size_t cumulative_total = 0;
+    const int n = p.size ();
+    const int half_width = filter_width / 2;
 
-    // For each pixel get cumulative sums and counts
-    for (size_t i = 0; i < p.size (); ++i)
+    // Get cumulative sums across the vector
+    double cumulative_sum = 0.0;
+    for (int i = 0; i < n; ++i)
     {
-        // Get running sum and total
         cumulative_sum += p[i];
-        ++cumulative_total;
-
-        // Remember them
         sums[i] = cumulative_sum;
-        totals[i] = cumulative_total;
     }
 
-    // Return value
-    T q (p.size ());
+    // Get the average of a window that may be clipped by the edges
+    const auto clipped = [&](const int i)
+    {
+        const int i1 = i - half_width - 1;
+        const int i2 = std::min (i + half_width, n - 1);
+        const double sum1 = (i1 < 0) ? 0 : sums[i1];
+        const int total1 = (i1 < 0) ? 0 : i1 + 1;
+        const double sum = sums[i2] - sum1;
+        const int total = (i2 + 1) - total1;
+        assert (total > 0);
+        return sum / total;
+    };
+
+    // Windows in [first, last) are not clipped
+    const int first = std::min (half_width + 1, n);
+    const int last = std::max (first, n - half_width);
+
+    for (int i = 0; i < first; ++i)
+        p[i] = clipped (i);
+    for (int i = first; i < last; ++i)
+        p[i] = (sums[i + half_width] - sums[i - half_width - 1]) / filter_width;
+    for (int i = last; i < n; ++i)
+        p[i] = clipped (i);
+}
+
+template<typename T>
+T box_filter (const T &p, const int filter_width)
+{
+    T q (p);
+    std::vector<double> sums (p.size ());
+    box_filter_in_place (q, sums, filter_width);
+    return q;
+}
+
+namespace detail
+{
 
-    // Now go back and fill in filter values based upon sums and totals
-    for (size_t i = 0; i < q.size (); ++i)
+// Fill in the gaps in a series of 1m averages, and then smooth them,
+// in place
+//
+// 'scratch' must be the same size as 'avg'.
+inline void smooth_elevations (std::vector<double> &avg,
+    std::vector<double> &scratch,
+    const double sigma)
+{
+    using namespace std;
+
+    assert (!avg.empty ());
+    assert (scratch.size () == avg.size ());
+
+    // Interpolate across each block of consecutive nan's, see
+    // get_nan_pairs ()
+    for (size_t i = 0; i < avg.size (); )
     {
-        const int i1 = i - filter_width / 2 - 1;
-        const int i2 = i + filter_width / 2;
+        if (!std::isnan (avg[i]))
+        {
+            ++i;
+            continue;
+        }
 
-        // Clip the index values to the edges of the row
-        const double sum1 = (i1 < 0) ? 0 : sums[i1];
-        const size_t total1 = (i1 < 0) ? 0 : totals[i1];
-        const double sum2 = (i2 >= static_cast<int>(p.size ())) ? sums[p.size () - 1] : sums[i2];
-        const size_t total2 = (i2 >= static_cast<int>(p.size ())) ? totals[p.size () - 1] : totals[i2];
+        // Find the end of the block
+        size_t j = i + 1;
+        while (j < avg.size () && std::isnan (avg[j]))
+            ++j;
 
-        // Compute sum and total at pixel 'i'.
-        const double sum = sum2 - sum1;
-        const int total = total2 - total1;
-        assert (total > 0);
+        // Get the two non-nan values on either side of the block
+        const size_t left = i == 0 ? 0 : i - 1;
+        const size_t right = j == avg.size () ? avg.size () - 1 : j;
+        interpolate_nans (avg, make_pair (left, right));
 
-        // Get the average over the window of size 'filter_width' at pixel 'i'
-        q[i] = sum / total;
+        i = j;
     }
 
-    return q;
+    // Run a box filter over the averaged values
+    const unsigned iterations = 4;
+
+    // See: https://www.peterkovesi.com/papers/FastGaussianSmoothing.pdf
+    const double ideal_filter_width = std::sqrt ((12.0 * sigma * sigma) / iterations + 1.0);
+    const int filter_width = std::max (static_cast<int> (ideal_filter_width / 2.0), 1) * 2 + 1;
+
+    // Apply Gaussian smoothing
+    for (size_t i = 0; i < iterations; ++i)
+        box_filter_in_place (avg, scratch, filter_width);
 }
 
+} // namespace detail
+
 template<typename T>
-std::vector<double> get_elevation_estimates (T p, const double sigma, const unsigned cls)
+std::vector<double> get_elevation_estimates (const T &p, const double sigma, const unsigned cls)
 {
     using namespace std;
 
@@ -286,23 +351,9 @@ std::vector<double> get_elevation_estimates (T p, const double sigma, const unsi
     // Get 1m window averages
     auto avg = get_quantized_average (p, cls);
 
-    // Get indexes of values to interpolate between
-    const auto np = get_nan_pairs (avg);
-
-    // Interpolate values between each pair
-    for (auto n : np)
-        interpolate_nans (avg, n);
-
-    // Run a box filter over the averaged values
-    const unsigned iterations = 4;
-
-    // See: https://www.peterkovesi.com/papers/FastGaussianSmoothing.pdf
-    const double ideal_filter_width = std::sqrt ((12.0 * sigma * sigma) / iterations + 1.0);
-    const int filter_width = std::max (static_cast<int> (ideal_filter_width / 2.0), 1) * 2 + 1;
-
-    // Apply Gaussian smoothing
-    for (size_t i = 0; i < iterations; ++i)
-        avg = box_filter (avg, filter_width);
+    // Interpolate and smooth them
+    vector<double> scratch (avg.size ());
+    detail::smooth_elevations (avg, scratch, sigma);
 
     // Get min extent
     const unsigned min_x = p[0].x;
@@ -338,6 +389,157 @@ std::vector<double> get_bathy_estimates (const T &p, const double sigma)
     return get_elevation_estimates (p, sigma, bathy_class);
 }
 
+namespace detail
+{
+
+// 1m averages of the surface and bathy photons along the track, see
+// get_elevation_estimates ()
+//
+// The bins start at 'min_x'. Photons are added in order along the
+// track, and the bins grow to hold them. Once they have all been added,
+// the bins are smoothed, and then they give the estimates at any point.
+class elevation_bins
+{
+    public:
+    explicit elevation_bins (const unsigned init_min_x)
+        : min_x (init_min_x)
+        , counts { 0, 0 }
+    {
+    }
+    void reserve (const size_t n)
+    {
+        for (size_t c = 0; c < classes.size (); ++c)
+        {
+            sums[c].reserve (n);
+            totals[c].reserve (n);
+        }
+    }
+    void add (const double x, const double z, const size_t prediction)
+    {
+        // Surface is class 0, bathy is class 1
+        const size_t c = prediction == classes[0] ? 0 : (prediction == classes[1] ? 1 : 2);
+        if (c == 2)
+            return;
+
+        // Get along-track index
+        const double distance = x - min_x;
+        assert (distance >= 0.0);
+        const unsigned j = std::floor (distance);
+
+        // Count the value
+        if (j >= totals[c].size ())
+        {
+            sums[c].resize (j + 1);
+            totals[c].resize (j + 1);
+        }
+        ++totals[c][j];
+        sums[c][j] += z;
+        ++counts[c];
+    }
+    // Average and smooth the bins, given the last point's 'x'
+    //
+    // Both classes are smoothed at the same time if 'parallel' is set.
+    void smooth (const double last_x,
+        const double surface_sigma,
+        const double bathy_sigma,
+        const bool parallel)
+    {
+        using namespace std;
+
+        // Get extent
+        const unsigned max_x = last_x + 1.0;
+
+        // Values should be sorted
+        assert (min_x < max_x);
+        const size_t total = max_x - min_x;
+
+        const array<double, 2> sigmas { surface_sigma, bathy_sigma };
+
+        // Smooth each class, reusing the totals for the averages and the
+        // sums for scratch space
+#pragma omp parallel for num_threads(2) if (parallel)
+        for (size_t c = 0; c < classes.size (); ++c)
+        {
+            assert (totals[c].size () <= total);
+            sums[c].resize (total);
+            totals[c].resize (total);
+
+            // Degenerate case
+            if (counts[c] == 0)
+                continue;
+
+            // Get the average
+            auto &avg = totals[c];
+            for (size_t i = 0; i < avg.size (); ++i)
+                avg[i] = avg[i] != 0 ? sums[c][i] / avg[i] : NAN;
+
+            detail::smooth_elevations (avg, sums[c], sigmas[c]);
+        }
+    }
+    double get_surface_estimate (const double x) const
+    {
+        return get_estimate (0, x);
+    }
+    double get_bathy_estimate (const double x) const
+    {
+        return get_estimate (1, x);
+    }
+
+    private:
+    static constexpr std::array<unsigned, 2> classes { sea_surface_class, bathy_class };
+    unsigned min_x;
+    std::array<std::vector<double>, 2> sums;
+    std::array<std::vector<double>, 2> totals;
+    std::array<size_t, 2> counts;
+
+    double get_estimate (const size_t c, const double x) const
+    {
+        // Values should be sorted
+        assert (min_x <= x);
+
+        // Get along-track index
+        const unsigned j = x - min_x;
+        assert (j < totals[c].size ());
+
+        return counts[c] == 0 ? 0.0 : totals[c][j];
+    }
+};
+
+} // namespace detail
+
+// Set the surface and bathy elevation estimates of each photon
+//
+// This gives the same estimates as get_surface_estimates () and
+// get_bathy_estimates (), but both classes are binned in one pass over
+// the photons, and they are smoothed at the same time if 'parallel' is
+// set.
+template<typename T>
+void set_elevation_estimates (T &p,
+    const double surface_sigma,
+    const double bathy_sigma,
+    const bool parallel = false)
+{
+    using namespace std;
+
+    if (p.empty ())
+        return;
+
+    // Get 1m window sums for both classes
+    detail::elevation_bins bins (p[0].x);
+    bins.reserve (size_t (p.back ().x + 1.0) - size_t (p[0].x));
+    for (size_t i = 0; i < p.size (); ++i)
+        bins.add (p[i].x, p[i].z, p[i].prediction);
+
+    bins.smooth (p.back ().x, surface_sigma, bathy_sigma, parallel);
+
+    // Fill in the estimates with the filtered points
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        p[i].surface_elevation = bins.get_surface_estimate (p[i].x);
+        p[i].bathy_elevation = bins.get_bathy_estimate (p[i].x);
+    }
+}
+
 namespace sampling_params
 {
     const size_t patch_rows = 63;
@@ -359,140 +561,538 @@ void print_sampling_params (std::ostream &os)
 //      + raster size
 constexpr size_t FEATURES_PER_SAMPLE = 1 + sampling_params::patch_rows * sampling_params::patch_cols;
 
+// Prediction cache keyed by a patch's raster cells
+using patch_cache = prediction_cache<FEATURES_PER_SAMPLE - 1>;
+
+struct classify_params
+{
+    // 0 = use all available threads
+    size_t threads = 1;
+    // Send only the occupied raster cells to the booster
+    bool sparse = false;
+    // Which inference engine to use, "xgboost", "native" or "quickscorer"
+    std::string predictor = "xgboost";
+    // Serve repeated patches from a prediction cache
+    bool cache = false;
+    // Most patches to keep in the prediction cache
+    size_t cache_entries = 1 << 16;
+};
+
+// Fill 'f' with the features for points [begin, end)
 template<typename T>
-T classify (const bool verbose, T p, const std::string &model_filename)
+void create_features (const T &p,
+    const size_t begin,
+    const size_t end,
+    std::vector<float> &f)
 {
     using namespace std;
-    using namespace ATL24_coastnet;
 
-    // Get indexes into p
-    vector<size_t> sorted_indexes (p.size ());
+    // Check invariants
+    assert (begin < end);
+    assert (end <= p.size ());
 
-    // 0, 1, 2, ...
-    iota (sorted_indexes.begin (), sorted_indexes.end (), 0);
+    const size_t cols = FEATURES_PER_SAMPLE;
+    f.resize ((end - begin) * cols);
 
-    // Sort indexes by X
-    sort (sorted_indexes.begin (), sorted_indexes.end (),
-        [&](const auto &a, const auto &b)
-        { return p[a].x < p[b].x; });
+    // The points are visited in order, so the patch boundaries only
+    // move forward
+    patch_builder<T> pb (p, sampling_params::patch_rows, sampling_params::patch_cols, sampling_params::aspect_ratio);
+    raster::raster<unsigned char> r (sampling_params::patch_rows, sampling_params::patch_cols);
 
-    // Sort points by X
-    sort (p.begin (), p.end (),
-        [&](const auto &a, const auto &b)
-        { return a.x < b.x; });
+    // Get the rasters for each point
+    for (size_t index = begin; index < end; ++index)
+    {
+        const size_t j = index - begin;
 
-    // Zero out the predictions
-    for (size_t i = 0; i < p.size (); ++i)
-        p[i].prediction = 0;
+        // Create the raster at this point
+        pb.create_raster (index, r);
 
-    // Create the booster
-    xgboost::xgbooster xgb (verbose);
-    xgb.load_model (model_filename);
+        // The first feature is the elevation
+        f[j * cols] = p[index].z;
 
-    // Predict in batches
-    const size_t batch_size = 1000;
+        // The rest of the features are the raster values
+        for (size_t k = 0; k < r.size (); ++k)
+        {
+            const size_t n = j * cols + 1 + k;
+            assert (n < f.size ());
+            f[n] = r[k];
+        }
+    }
+}
+
+// Fill 'f' with the sparse features for points [begin, end)
+//
+// The elevation is always stored, but only the occupied raster cells
+// are stored. Nearly all raster cells are empty.
+template<typename T>
+void create_features (const T &p,
+    const size_t begin,
+    const size_t end,
+    xgboost::sparse_features &f)
+{
+    using namespace std;
 
-    // For each point
-    for (size_t i = 0; i < p.size (); )
+    // Check invariants
+    assert (begin < end);
+    assert (end <= p.size ());
+
+    f.clear ();
+
+    // The points are visited in order, so the patch boundaries only
+    // move forward
+    patch_builder<T> pb (p, sampling_params::patch_rows, sampling_params::patch_cols, sampling_params::aspect_ratio);
+    raster::raster<unsigned char> r (sampling_params::patch_rows, sampling_params::patch_cols);
+
+    // Get the rasters for each point
+    for (size_t index = begin; index < end; ++index)
     {
-        // Get a vector of indexes
-        vector<size_t> indexes;
-        indexes.reserve (batch_size);
+        // Create the raster at this point
+        pb.create_raster (index, r);
 
-        // Fill the vector of indexes
-        while (i < p.size () && indexes.size () != batch_size)
-        {
-            // Save it
-            indexes.push_back (i);
+        // The first feature is the elevation
+        f.indices.push_back (0);
+        f.values.push_back (p[index].z);
 
-            // Go to the next one
-            ++i;
+        // The rest of the features are the occupied raster cells
+        for (size_t k = 0; k < r.size (); ++k)
+        {
+            if (r[k] == 0)
+                continue;
+            f.indices.push_back (1 + k);
+            f.values.push_back (r[k]);
         }
 
-        // Get number of samples to predict
-        const size_t rows = indexes.size ();
+        // End of the row
+        f.indptr.push_back (f.values.size ());
+    }
+}
 
-        // Create the features
-        const size_t cols = FEATURES_PER_SAMPLE;
-        vector<float> f (rows * cols);
+namespace detail
+{
+
+// Points per batch when predicting
+constexpr size_t predict_batch_size = 1000;
 
-        // Get the rasters for each point
-        for (size_t j = 0; j < indexes.size (); ++j)
+struct cache_stats
+{
+    size_t lookups = 0;
+    size_t predicted = 0;
+    double predict_ms = 0.0;
+};
+
+// Predict the rows in 'misses' using 'predict_rows', save them in the
+// cache, and give each row that was not found in the cache its
+// prediction
+template<typename F>
+void predict_misses (F predict_rows,
+    const std::vector<patch_cache::key_type> &keys,
+    const std::vector<size_t> &misses,
+    const std::vector<size_t> &miss_index,
+    patch_cache &cache,
+    std::vector<uint32_t> &predictions,
+    cache_stats &stats)
+{
+    using namespace std;
+
+    if (misses.empty ())
+        return;
+
+    timer t;
+    const auto q = predict_rows ();
+    t.stop ();
+    assert (q.size () == misses.size ());
+
+    for (size_t k = 0; k < misses.size (); ++k)
+        cache.update (keys[misses[k]], q[k]);
+
+    for (size_t j = 0; j < predictions.size (); ++j)
+        if (miss_index[j] != numeric_limits<size_t>::max ())
+            predictions[j] = q[miss_index[j]];
+
+    stats.predicted += misses.size ();
+    stats.predict_ms += t.elapsed_ms ();
+}
+
+// Look up each row's patch in the cache, and only predict the unique
+// patches that are not already there
+template<typename T>
+std::vector<uint32_t> predict (const T &predictor,
+    const std::vector<float> &f,
+    const size_t rows,
+    const size_t cols,
+    patch_cache &cache,
+    cache_stats &stats)
+{
+    using namespace std;
+
+    vector<uint32_t> predictions (rows);
+    vector<patch_cache::key_type> keys (rows);
+    unordered_map<patch_cache::key_type,size_t,patch_cache::key_hash> unique_keys;
+    vector<size_t> misses;
+    vector<size_t> miss_index (rows, numeric_limits<size_t>::max ());
+
+    for (size_t j = 0; j < rows; ++j)
+    {
+        const float *row = &f[j * cols];
+        keys[j] = cache.get_key (row[0], row + 1);
+        if (cache.find (keys[j], predictions[j]))
+            continue;
+
+        // Repeats within the batch only get predicted once
+        const auto [it, inserted] = unique_keys.try_emplace (keys[j], misses.size ());
+        if (inserted)
+            misses.push_back (j);
+        miss_index[j] = it->second;
+    }
+
+    // Gather the rows to predict
+    vector<float> g (misses.size () * cols);
+    for (size_t k = 0; k < misses.size (); ++k)
+        copy (&f[misses[k] * cols], &f[misses[k] * cols] + cols, &g[k * cols]);
+
+    predict_misses ([&] { return predictor.predict (g, misses.size (), cols); },
+        keys, misses, miss_index, cache, predictions, stats);
+    stats.lookups += rows;
+
+    return predictions;
+}
+
+// Sparse version
+template<typename T>
+std::vector<uint32_t> predict (const T &predictor,
+    const xgboost::sparse_features &f,
+    const size_t cols,
+    patch_cache &cache,
+    cache_stats &stats)
+{
+    using namespace std;
+
+    const size_t rows = f.rows ();
+    vector<uint32_t> predictions (rows);
+    vector<patch_cache::key_type> keys (rows);
+    unordered_map<patch_cache::key_type,size_t,patch_cache::key_hash> unique_keys;
+    vector<size_t> misses;
+    vector<size_t> miss_index (rows, numeric_limits<size_t>::max ());
+    vector<float> row (cols);
+
+    for (size_t j = 0; j < rows; ++j)
+    {
+        // Expand the row to get its key
+        fill (row.begin (), row.end (), 0.0f);
+        for (size_t k = f.indptr[j]; k < f.indptr[j + 1]; ++k)
+            row[f.indices[k]] = f.values[k];
+
+        keys[j] = cache.get_key (row[0], &row[1]);
+        if (cache.find (keys[j], predictions[j]))
+            continue;
+
+        // Repeats within the batch only get predicted once
+        const auto [it, inserted] = unique_keys.try_emplace (keys[j], misses.size ());
+        if (inserted)
+            misses.push_back (j);
+        miss_index[j] = it->second;
+    }
+
+    // Gather the rows to predict
+    xgboost::sparse_features g;
+    g.clear ();
+    for (const auto j : misses)
+    {
+        g.indices.insert (g.indices.end (), &f.indices[0] + f.indptr[j], &f.indices[0] + f.indptr[j + 1]);
+        g.values.insert (g.values.end (), &f.values[0] + f.indptr[j], &f.values[0] + f.indptr[j + 1]);
+        g.indptr.push_back (g.values.size ());
+    }
+
+    predict_misses ([&] { return predictor.predict (g, cols); },
+        keys, misses, miss_index, cache, predictions, stats);
+    stats.lookups += rows;
+
+    return predictions;
+}
+
+// Predict the points in [begin, end) of 'p', which is sorted by X
+//
+// The points outside of [begin, end) are only used to build the
+// patches.
+template<typename T,typename U>
+void predict_points (const bool verbose,
+    T &p,
+    const size_t begin_index,
+    const size_t end_index,
+    const U &predictor,
+    const classify_params &cp,
+    std::optional<patch_cache> &cache,
+    cache_stats &stats)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (begin_index <= end_index);
+    assert (end_index <= p.size ());
+
+    // Predict in batches
+    const size_t batch_size = predict_batch_size;
+    const size_t total_batches = (end_index - begin_index + batch_size - 1) / batch_size;
+    const int threads = cp.threads == 0 ? omp_get_max_threads () : cp.threads;
+
+    if (verbose)
+        clog << "Classifying " << total_batches << " batches using " << threads << " threads"
+            << (cp.sparse ? " and sparse features" : "") << endl;
+
+    // Each thread featurizes whole batches into its own buffer and
+    // predicts them in place from that buffer
+#pragma omp parallel num_threads(threads)
+    {
+        // Per-thread feature buffers
+        vector<float> f;
+        xgboost::sparse_features sf;
+        cache_stats thread_stats;
+
+#pragma omp for schedule(dynamic)
+        for (size_t b = 0; b < total_batches; ++b)
         {
-            // Get point sample index
-            assert (j < indexes.size ());
-            const size_t index = indexes[j];
-            assert (index < p.size ());
+            // Get the points in this batch
+            const size_t begin = begin_index + b * batch_size;
+            const size_t end = std::min (begin + batch_size, end_index);
 
-            // Create the raster at this point
-            auto r = create_raster (p, index, sampling_params::patch_rows, sampling_params::patch_cols, sampling_params::aspect_ratio);
+            // Get number of samples to predict
+            const size_t rows = end - begin;
+            const size_t cols = FEATURES_PER_SAMPLE;
 
-            // The first feature is the elevation
-            f[j * cols] = p[index].z;
+            // Create the features and process the batch
+            vector<uint32_t> predictions;
+            if (cp.sparse)
+            {
+                create_features (p, begin, end, sf);
+                predictions = cache
+                    ? predict (predictor, sf, cols, *cache, thread_stats)
+                    : predictor.predict (sf, cols);
+            }
+            else
+            {
+                create_features (p, begin, end, f);
+                predictions = cache
+                    ? predict (predictor, f, rows, cols, *cache, thread_stats)
+                    : predictor.predict (f, rows, cols);
+            }
+            assert (predictions.size () == rows);
 
-            // The rest of the features are the raster values
-            for (size_t k = 0; k < r.size (); ++k)
+            // Get the prediction for each batch point
+            for (size_t j = 0; j < rows; ++j)
             {
-                const size_t n = j * cols + 1 + k;
-                assert (n < f.size ());
-                f[n] = r[k];
+                // Remap prediction
+                const unsigned pred = reverse_label_map.at (predictions[j]);
+
+                // Save predicted value
+                assert (begin + j < p.size ());
+                p[begin + j].prediction = pred;
             }
         }
 
-        // Process the batch
-        const auto predictions = xgb.predict (f, rows, cols);
-        assert (predictions.size () == rows);
-
-        // Get the prediction for each batch point
-        for (size_t j = 0; j < indexes.size (); ++j)
+#pragma omp critical (classify_cache_stats)
         {
-            // Remap prediction
-            const unsigned pred = reverse_label_map.at (predictions[j]);
-
-            // Get point sample index
-            assert (j < indexes.size ());
-            const size_t index = indexes[j];
-            assert (index < p.size ());
-
-            // Save predicted value
-            p[index].prediction = pred;
+            stats.lookups += thread_stats.lookups;
+            stats.predicted += thread_stats.predicted;
+            stats.predict_ms += thread_stats.predict_ms;
         }
     }
+}
+
+inline void print_cache_stats (const std::optional<patch_cache> &cache, const cache_stats &stats)
+{
+    using namespace std;
+
+    if (!cache)
+        return;
+
+    // Estimate the time saved from the average prediction time
+    const size_t repeats = stats.lookups - stats.predicted;
+    const double saved_ms = stats.predicted == 0 ? 0.0 : repeats * stats.predict_ms / stats.predicted;
+    clog << "Prediction cache: " << repeats << " of " << stats.lookups << " patches ("
+        << (stats.lookups == 0 ? 0.0 : 100.0 * repeats / stats.lookups)
+        << "%) were repeats, " << cache->size () << " cached, saved about "
+        << saved_ms << "ms of prediction" << endl;
+}
+
+// Classify points in place using any predictor with the xgbooster
+// interface
+//
+// 'p' can be any random access container of points, including a
+// std::span over the caller's points. If the points are not sorted by
+// X, they are sorted in place, and then put back in their original
+// order, so the points themselves are never copied.
+template<typename T,typename U>
+void classify_in_place (const bool verbose,
+    T &p,
+    const U &predictor,
+    const classify_params &cp)
+{
+    using namespace std;
+    using namespace ATL24_coastnet;
+
+    // The predictor must be set up for the type of features we use
+    if (cp.sparse && !predictor.is_sparse ())
+        throw runtime_error ("The booster has not been set up for sparse features");
+
+    // Sort points by X
+    ordering::ordering_params op;
+    op.threads = cp.threads;
+    const auto order = ordering::get_x_order (p, op);
+    if (!order.empty ())
+        ordering::gather_in_place (p, order);
+
+    // Zero out the predictions
+    for (size_t i = 0; i < p.size (); ++i)
+        p[i].prediction = 0;
+
+    // Repeated patches can be served from a cache that all the threads share
+    optional<patch_cache> cache;
+    if (cp.cache)
+        cache.emplace (predictor.get_elevation_splits (), cp.cache_entries);
+    cache_stats stats;
+
+    timer t;
+
+    predict_points (verbose, p, 0, p.size (), predictor, cp, cache, stats);
 
     if (verbose)
+    {
+        t.stop ();
+        clog << "Classified " << p.size () << " points in " << t.elapsed_ms () << "ms ("
+            << (t.elapsed_ms () == 0 ? 0.0 : 1000.0 * p.size () / t.elapsed_ms ())
+            << " points/sec)" << endl;
+        print_cache_stats (cache, stats);
         clog << "Getting surface and bathy estimates" << endl;
+    }
 
     // Do post-processing
     postprocess_params params;
 
     // Compute surface and bathy estimates
-    const auto s = get_surface_estimates (p, params.surface_sigma);
-    const auto b = get_bathy_estimates (p, params.bathy_sigma);
-
-    assert (s.size () == p.size ());
-    assert (b.size () == p.size ());
-
-    // Assign surface and bathy estimates
-    for (size_t j = 0; j < p.size (); ++j)
-    {
-        p[j].surface_elevation = s[j];
-        p[j].bathy_elevation = b[j];
-    }
+    set_elevation_estimates (p, params.surface_sigma, params.bathy_sigma, cp.threads != 1);
 
     // Apply blunder detection
     if (verbose)
         clog << "Re-classifying points" << endl;
 
-    p = blunder_detection (p, params);
+    blunder_detection_in_place (p, params);
 
     // Restore original order
-    auto tmp (p);
-    for (size_t i = 0; i < sorted_indexes.size (); ++i)
-        p[sorted_indexes[i]] = tmp[i];
+    if (!order.empty ())
+        ordering::scatter_in_place (p, order);
+}
 
+// Classify a copy of the points
+template<typename T,typename U>
+T classify (const bool verbose,
+    T p,
+    const U &predictor,
+    const classify_params &cp)
+{
+    classify_in_place (verbose, p, predictor, cp);
     return p;
 }
 
+} // namespace detail
+
+// Classify points using a booster that has already been loaded
+//
+// The booster is only used for prediction, so one booster can be
+// shared by many calls, including calls from different threads.
+template<typename T>
+T classify (const bool verbose,
+    const T &p,
+    const xgboost::xgbooster &xgb,
+    const classify_params &cp = classify_params ())
+{
+    return detail::classify (verbose, p, xgb, cp);
+}
+
+// Classify points using the built-in inference engine
+template<typename T>
+T classify (const bool verbose,
+    const T &p,
+    const xgboost::tree_ensemble &te,
+    const classify_params &cp = classify_params ())
+{
+    return detail::classify (verbose, p, te, cp);
+}
+
+// Classify points using the bitmask inference engine
+template<typename T>
+T classify (const bool verbose,
+    const T &p,
+    const xgboost::quickscorer &qs,
+    const classify_params &cp = classify_params ())
+{
+    return detail::classify (verbose, p, qs, cp);
+}
+
+// Classify the caller's points in place, see detail::classify_in_place ()
+template<typename T>
+void classify_in_place (const bool verbose,
+    T &p,
+    const xgboost::xgbooster &xgb,
+    const classify_params &cp = classify_params ())
+{
+    detail::classify_in_place (verbose, p, xgb, cp);
+}
+
+template<typename T>
+void classify_in_place (const bool verbose,
+    T &p,
+    const xgboost::tree_ensemble &te,
+    const classify_params &cp = classify_params ())
+{
+    detail::classify_in_place (verbose, p, te, cp);
+}
+
+template<typename T>
+void classify_in_place (const bool verbose,
+    T &p,
+    const xgboost::quickscorer &qs,
+    const classify_params &cp = classify_params ())
+{
+    detail::classify_in_place (verbose, p, qs, cp);
+}
+
+template<typename T>
+T classify (const bool verbose,
+    const T &p,
+    const std::string &model_filename,
+    const classify_params &cp = classify_params ())
+{
+    using namespace std;
+
+    if (cp.predictor == "native")
+    {
+        xgboost::tree_ensemble te (verbose);
+        te.load_model (model_filename);
+
+        return classify (verbose, p, te, cp);
+    }
+
+    if (cp.predictor == "quickscorer")
+    {
+        xgboost::quickscorer qs (verbose);
+        qs.load_model (model_filename);
+
+        return classify (verbose, p, qs, cp);
+    }
+
+    if (cp.predictor != "xgboost")
+        throw runtime_error ("Unknown predictor: " + cp.predictor);
+
+    // Create the booster
+    xgboost::xgbooster xgb (verbose);
+    xgb.load_model (model_filename);
+
+    if (cp.sparse)
+        xgb.enable_sparse_features ();
+
+    return classify (verbose, p, xgb, cp);
+}
+
 template<typename T>
 class features
 {
@@ -513,26 +1113,37 @@ class features
         const size_t rows = dataset.size ();
         const size_t cols = FEATURES_PER_SAMPLE;
         vector<float> f (rows * cols);
+        get_features (0, rows, f.data ());
+
+        return f;
+    }
+    // Get the features of samples [begin, end) as a row-major matrix
+    void get_features (const size_t begin, const size_t end, float *f) const
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (begin <= end);
+        assert (end <= dataset.size ());
+
+        const size_t cols = FEATURES_PER_SAMPLE;
 
         // Stuff values into features vector
-        for (size_t i = 0; i < rows; ++i)
+#pragma omp parallel for
+        for (size_t i = begin; i < end; ++i)
         {
+            float *row = f + (i - begin) * cols;
+
             // First feature is the photon's elevation
-            assert (i * cols < f.size ());
-            f[i * cols] = dataset.get_elevation (i);
+            row[0] = dataset.get_elevation (i);
 
             // The other features are the raster values
             const auto r = dataset.get_raster (i);
+            assert (r.size () + 1 == cols);
 
             for (size_t j = 0; j < r.size (); ++j)
-            {
-                const size_t index = i * cols + 1 + j;
-                assert (index < f.size ());
-                f[index] = r[j];
-            }
+                row[1 + j] = r[j];
         }
-
-        return f;
     }
     std::vector<unsigned> get_labels () const
     {
@@ -0,0 +1,448 @@
+#pragma once
+
+#include "precompiled.h"
+#include "mapped_file.h"
+
+namespace ATL24_coastnet
+{
+
+// Binary columnar photon tables
+//
+// A columnar file holds the same table as a CSV file, but each column
+// is stored as a block of raw little-endian values, so a reader can map
+// the file and use the columns in place, without parsing or copying.
+//
+// Layout:
+//
+//     char[8]  magic, "ATL24COL"
+//     uint32   version
+//     uint32   number of columns
+//     uint64   number of rows
+//     for each column:
+//         uint32   column type
+//         uint32   name length
+//         char[]   name, not terminated
+//     padding to a multiple of 'alignment' bytes
+//     for each column:
+//         rows * type_size () bytes of values
+//         padding to a multiple of 'alignment' bytes
+//
+// Every column block starts on an 'alignment' byte boundary, so the
+// values can be read through a pointer to their type.
+namespace columnar
+{
+
+static_assert (std::endian::native == std::endian::little, "Columnar files are stored little-endian");
+
+constexpr char magic[8] = { 'A', 'T', 'L', '2', '4', 'C', 'O', 'L' };
+constexpr uint32_t version = 1;
+constexpr size_t alignment = 64;
+
+enum class column_type : uint32_t
+{
+    float64 = 0,
+    float32 = 1,
+    int64 = 2,
+    int32 = 3,
+    uint8 = 4,
+};
+
+inline size_t type_size (const column_type t)
+{
+    switch (t)
+    {
+        case column_type::float64: return sizeof (double);
+        case column_type::float32: return sizeof (float);
+        case column_type::int64: return sizeof (int64_t);
+        case column_type::int32: return sizeof (int32_t);
+        case column_type::uint8: return sizeof (uint8_t);
+    }
+    throw std::runtime_error ("Unknown column type");
+}
+
+inline std::string type_name (const column_type t)
+{
+    switch (t)
+    {
+        case column_type::float64: return "float64";
+        case column_type::float32: return "float32";
+        case column_type::int64: return "int64";
+        case column_type::int32: return "int32";
+        case column_type::uint8: return "uint8";
+    }
+    throw std::runtime_error ("Unknown column type");
+}
+
+// Get the column type that stores values of type 'T'
+template<typename T>
+constexpr column_type get_column_type ()
+{
+    if constexpr (std::is_same_v<T, double>)
+        return column_type::float64;
+    else if constexpr (std::is_same_v<T, float>)
+        return column_type::float32;
+    else if constexpr (std::is_same_v<T, int64_t>)
+        return column_type::int64;
+    else if constexpr (std::is_same_v<T, int32_t>)
+        return column_type::int32;
+    else
+    {
+        static_assert (std::is_same_v<T, uint8_t>, "Unsupported column type");
+        return column_type::uint8;
+    }
+}
+
+inline size_t pad (const size_t n)
+{
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+// Does the buffer start with a columnar file header?
+inline bool is_columnar (const char *begin, const char *end)
+{
+    return size_t (end - begin) >= sizeof (magic)
+        && std::memcmp (begin, magic, sizeof (magic)) == 0;
+}
+
+// Is the file a columnar file?
+//
+// Only regular files are checked, so a pipe does not lose its header.
+inline bool is_columnar (const std::string &fn)
+{
+    if (!is_regular_file (fn))
+        return false;
+    std::ifstream ifs (fn, std::ios::binary);
+    char buffer[sizeof (magic)];
+    if (!ifs.read (buffer, sizeof (buffer)))
+        return false;
+    return is_columnar (buffer, buffer + sizeof (buffer));
+}
+
+// A read-only columnar table
+//
+// The table either maps a file, or owns a buffer that was read from a
+// stream. In both cases the columns are views into that memory, and
+// they are only valid while the table is alive.
+class table
+{
+    public:
+    // Map a file
+    explicit table (const std::string &fn)
+        : file (std::make_unique<mapped_file> (fn))
+    {
+        parse_header (file->begin (), file->end ());
+    }
+    // Take ownership of a buffer
+    explicit table (std::vector<char> &&init_buffer)
+        : buffer (std::move (init_buffer))
+    {
+        parse_header (buffer.data (), buffer.data () + buffer.size ());
+    }
+    table (table &&) = default;
+    table &operator= (table &&) = default;
+
+    bool is_valid () const
+    {
+        return headers.size () == columns.size () && headers.size () == header_column.size ();
+    }
+    const std::vector<std::string> get_headers () const
+    {
+        return headers;
+    }
+    size_t cols () const
+    {
+        assert (is_valid ());
+        return columns.size ();
+    }
+    size_t rows () const
+    {
+        return nrows;
+    }
+    bool has_column (const std::string &name) const
+    {
+        return header_column.find (name) != header_column.end ();
+    }
+    column_type get_type (const size_t col) const
+    {
+        assert (col < columns.size ());
+        return columns[col].type;
+    }
+    column_type get_type (const std::string &name) const
+    {
+        return get_type (get_column_index (name));
+    }
+    size_t get_column_index (const std::string &name) const
+    {
+        const auto it = header_column.find (name);
+        if (it == header_column.end ())
+            throw std::runtime_error ("Can't find '" + name + "' in columnar file");
+        return it->second;
+    }
+    // Get a column without copying it
+    template<typename T>
+    std::span<const T> get_column (const size_t col) const
+    {
+        assert (col < columns.size ());
+        if (columns[col].type != get_column_type<T> ())
+            throw std::runtime_error ("Column '" + headers[col] + "' is " + type_name (columns[col].type)
+                + ", not " + type_name (get_column_type<T> ()));
+
+        const char *p = data + columns[col].offset;
+        assert (reinterpret_cast<uintptr_t> (p) % alignof (T) == 0);
+        return std::span<const T> (reinterpret_cast<const T *> (p), nrows);
+    }
+    template<typename T>
+    std::span<const T> get_column (const std::string &name) const
+    {
+        return get_column<T> (get_column_index (name));
+    }
+    // Call 'f' with the values in a column, as a span of their stored
+    // type
+    template<typename F>
+    void visit_column (const size_t col, const F &f) const
+    {
+        assert (col < columns.size ());
+        switch (columns[col].type)
+        {
+            case column_type::float64: f (get_column<double> (col)); break;
+            case column_type::float32: f (get_column<float> (col)); break;
+            case column_type::int64: f (get_column<int64_t> (col)); break;
+            case column_type::int32: f (get_column<int32_t> (col)); break;
+            case column_type::uint8: f (get_column<uint8_t> (col)); break;
+        }
+    }
+    double get_value (const size_t col, const size_t row) const
+    {
+        assert (col < columns.size ());
+        assert (row < nrows);
+        const char *p = data + columns[col].offset;
+        switch (columns[col].type)
+        {
+            case column_type::float64: return reinterpret_cast<const double *> (p)[row];
+            case column_type::float32: return reinterpret_cast<const float *> (p)[row];
+            case column_type::int64: return reinterpret_cast<const int64_t *> (p)[row];
+            case column_type::int32: return reinterpret_cast<const int32_t *> (p)[row];
+            case column_type::uint8: return reinterpret_cast<const uint8_t *> (p)[row];
+        }
+        assert (false);
+        return 0.0;
+    }
+    double get_value (const std::string &name, const size_t row) const
+    {
+        // Make sure column name exists
+        assert (has_column (name));
+        return get_value (header_column.at (name), row);
+    }
+
+    private:
+    struct column_info
+    {
+        column_type type;
+        size_t offset;
+    };
+
+    std::unique_ptr<mapped_file> file;
+    std::vector<char> buffer;
+    const char *data = nullptr;
+    size_t nrows = 0;
+    std::vector<std::string> headers;
+    std::unordered_map<std::string,size_t> header_column;
+    std::vector<column_info> columns;
+
+    void parse_header (const char *begin, const char *end)
+    {
+        using namespace std;
+
+        const size_t size = end - begin;
+        size_t offset = 0;
+
+        // Read a value from the header
+        auto get = [&]<typename T> (T &x)
+        {
+            if (size - offset < sizeof (T))
+                throw runtime_error ("Columnar file header is truncated");
+            memcpy (&x, begin + offset, sizeof (T));
+            offset += sizeof (T);
+        };
+
+        if (!is_columnar (begin, end))
+            throw runtime_error ("Not a columnar file");
+        offset += sizeof (magic);
+
+        uint32_t file_version;
+        uint32_t ncols;
+        uint64_t file_rows;
+        get (file_version);
+        get (ncols);
+        get (file_rows);
+
+        if (file_version != version)
+            throw runtime_error ("Unsupported columnar file version: " + to_string (file_version));
+
+        columns.resize (ncols);
+        headers.resize (ncols);
+        for (size_t j = 0; j < ncols; ++j)
+        {
+            uint32_t type;
+            uint32_t name_length;
+            get (type);
+            get (name_length);
+
+            if (type > uint32_t (column_type::uint8))
+                throw runtime_error ("Unknown column type in columnar file: " + to_string (type));
+            if (size - offset < name_length)
+                throw runtime_error ("Columnar file header is truncated");
+
+            columns[j].type = column_type (type);
+            headers[j].assign (begin + offset, name_length);
+            offset += name_length;
+
+            if (has_column (headers[j]))
+                throw runtime_error ("Duplicate column in columnar file: " + headers[j]);
+            header_column[headers[j]] = j;
+        }
+
+        // The column blocks follow the header
+        offset = pad (offset);
+        for (size_t j = 0; j < ncols; ++j)
+        {
+            const size_t bytes = file_rows * type_size (columns[j].type);
+            if (file_rows > size / type_size (columns[j].type) || offset > size || size - offset < bytes)
+                throw runtime_error ("Columnar file is truncated");
+
+            columns[j].offset = offset;
+            offset = pad (offset + bytes);
+        }
+
+        data = begin;
+        nrows = file_rows;
+        assert (is_valid ());
+    }
+};
+
+// Build a columnar table and write it to a stream
+//
+// The writer does not copy the columns. Columns added as spans or
+// vectors are written in place, so they must stay alive until write ()
+// is called. Columns added as functions are evaluated when the table is
+// written, 'buffer_rows' rows at a time, so a column that needs a type
+// change, or that comes from an array of structs, is never held in
+// memory all at once.
+class writer
+{
+    public:
+    explicit writer (const size_t rows, const size_t init_buffer_rows = 1 << 16)
+        : nrows (rows)
+        , buffer_rows (init_buffer_rows)
+    {
+        // Check invariants
+        assert (buffer_rows != 0);
+    }
+    template<typename T>
+    void add_column (const std::string &name, const std::span<const T> values)
+    {
+        if (values.size () != nrows)
+            throw std::runtime_error ("Column '" + name + "' has the wrong number of rows");
+        push_column (name, get_column_type<T> (), reinterpret_cast<const char *> (values.data ()), { });
+    }
+    template<typename T>
+    void add_column (const std::string &name, const std::vector<T> &values)
+    {
+        add_column (name, std::span<const T> (values));
+    }
+    // The values would be gone by the time they are written
+    template<typename T>
+    void add_column (const std::string &name, std::vector<T> &&values) = delete;
+    // Add a column of type 'T' whose i'th value is 'get (i)'
+    template<typename T, typename F>
+    requires std::invocable<const F &, size_t>
+    void add_column (const std::string &name, F get)
+    {
+        push_column (name, get_column_type<T> (), nullptr,
+            [get] (const size_t begin, const size_t end, char *dst)
+            {
+                T *q = reinterpret_cast<T *> (dst);
+                for (size_t i = begin; i < end; ++i)
+                    q[i - begin] = get (i);
+            });
+    }
+    std::ostream &write (std::ostream &os) const
+    {
+        using namespace std;
+
+        // Build the header
+        string header (magic, sizeof (magic));
+        auto put = [&]<typename T> (const T x)
+        {
+            header.append (reinterpret_cast<const char *> (&x), sizeof (T));
+        };
+        put (version);
+        put (uint32_t (headers.size ()));
+        put (uint64_t (nrows));
+        for (size_t j = 0; j < headers.size (); ++j)
+        {
+            put (uint32_t (columns[j].type));
+            put (uint32_t (headers[j].size ()));
+            header += headers[j];
+        }
+        header.resize (pad (header.size ()), '\0');
+        os.write (header.data (), header.size ());
+
+        // Write the column blocks
+        const array<char, alignment> zeroes { };
+        vector<char> buffer;
+        for (const auto &c : columns)
+        {
+            const size_t size = type_size (c.type);
+            if (c.data != nullptr)
+            {
+                os.write (c.data, nrows * size);
+            }
+            else
+            {
+                buffer.resize (buffer_rows * size);
+                for (size_t begin = 0; begin < nrows; begin += buffer_rows)
+                {
+                    const size_t end = min (nrows, begin + buffer_rows);
+                    c.get (begin, end, buffer.data ());
+                    os.write (buffer.data (), (end - begin) * size);
+                }
+            }
+            os.write (zeroes.data (), pad (nrows * size) - nrows * size);
+        }
+
+        os.flush ();
+        return os;
+    }
+
+    private:
+    struct column
+    {
+        column_type type;
+        // Values that are written in place, or ...
+        const char *data;
+        // ... a function that fills a buffer with rows [begin, end)
+        std::function<void (const size_t, const size_t, char *)> get;
+    };
+
+    size_t nrows;
+    size_t buffer_rows;
+    std::vector<std::string> headers;
+    std::vector<column> columns;
+
+    void push_column (const std::string &name,
+        const column_type type,
+        const char *data,
+        std::function<void (const size_t, const size_t, char *)> get)
+    {
+        if (std::find (headers.begin (), headers.end (), name) != headers.end ())
+            throw std::runtime_error ("Column already exists");
+
+        headers.push_back (name);
+        columns.push_back (column { type, data, std::move (get) });
+    }
+};
+
+} // namespace columnar
+
+} // namespace ATL24_coastnet
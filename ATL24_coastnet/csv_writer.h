@@ -0,0 +1,100 @@
+#pragma once
+
+#include "precompiled.h"
+
+namespace ATL24_coastnet
+{
+
+namespace csv
+{
+
+// Append 'x' with 'precision' digits after the decimal point
+//
+// This gives the same text as an ostream with 'std::fixed' and
+// 'std::setprecision (precision)'.
+inline void append_fixed (std::string &s, const double x, const int precision)
+{
+    using namespace std;
+
+    array<char, 128> buffer;
+    const auto r = to_chars (buffer.data (), buffer.data () + buffer.size (), x, chars_format::fixed, precision);
+    if (r.ec == errc ())
+    {
+        s.append (buffer.data (), r.ptr);
+        return;
+    }
+
+    // Large values need more room
+    string tmp (numeric_limits<double>::max_exponent10 + precision + 16, '\0');
+    const auto r2 = to_chars (tmp.data (), tmp.data () + tmp.size (), x, chars_format::fixed, precision);
+    assert (r2.ec == errc ());
+    s.append (tmp.data (), r2.ptr);
+}
+
+inline void append_integer (std::string &s, const uint64_t x)
+{
+    using namespace std;
+
+    array<char, 24> buffer;
+    const auto r = to_chars (buffer.data (), buffer.data () + buffer.size (), x);
+    assert (r.ec == errc ());
+    s.append (buffer.data (), r.ptr);
+}
+
+inline void append_integer (std::string &s, const int64_t x)
+{
+    using namespace std;
+
+    array<char, 24> buffer;
+    const auto r = to_chars (buffer.data (), buffer.data () + buffer.size (), x);
+    assert (r.ec == errc ());
+    s.append (buffer.data (), r.ptr);
+}
+
+// Write 'rows' rows of CSV text
+//
+// 'format_row (s, i)' appends row 'i', including its newline, to 's'.
+// Blocks of rows are formatted in parallel into reusable buffers, and
+// then written in order, so the stream is written in large pieces
+// instead of one row at a time.
+//
+// 'format_row' must be safe to call from more than one thread at a
+// time. The blocks are formatted by 'threads' threads, 0 means use all
+// available threads.
+template<typename F>
+void write_rows (std::ostream &os, const size_t rows, const F &format_row, const size_t threads = 0)
+{
+    using namespace std;
+
+    const int nthreads = threads == 0 ? omp_get_max_threads () : threads;
+    const size_t rows_per_block = 1 << 14;
+    const size_t total_blocks = (rows + rows_per_block - 1) / rows_per_block;
+    const size_t blocks_per_batch = std::max (1, nthreads);
+    vector<string> buffers (std::min (blocks_per_batch, total_blocks));
+
+    for (size_t first = 0; first < total_blocks; first += buffers.size ())
+    {
+        const size_t n = std::min (buffers.size (), total_blocks - first);
+
+        // Format a batch of blocks
+#pragma omp parallel for num_threads(nthreads)
+        for (size_t k = 0; k < n; ++k)
+        {
+            buffers[k].clear ();
+            const size_t begin = (first + k) * rows_per_block;
+            const size_t end = std::min (rows, begin + rows_per_block);
+            for (size_t i = begin; i < end; ++i)
+                format_row (buffers[k], i);
+        }
+
+        // Write them in order
+        for (size_t k = 0; k < n; ++k)
+            os.write (buffers[k].data (), buffers[k].size ());
+    }
+
+    os.flush ();
+}
+
+} // namespace csv
+
+} // namespace ATL24_coastnet
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "aligned_allocator.h"
 #include "coastnet.h"
 #include "dataframe.h"
+#include "ordering.h"
 #include "raster.h"
 #include "utils.h"
 
@@ -19,7 +21,14 @@ class coastnet_dataset
 {
     std::vector<std::vector<ATL24_coastnet::classified_point2d>> datasets;
     std::vector<sample_index> sample_indexes;
-    std::vector<raster::raster<unsigned char>> rasters;
+    // The patches are stored one after another in a single slab, each
+    // padded to a whole number of cache lines
+    static constexpr size_t patch_alignment = 64;
+    std::vector<uint8_t, aligned_allocator<uint8_t, patch_alignment>> patches;
+    size_t patch_pitch = 0;
+    std::vector<float> elevations;
+    std::vector<size_t> random_seeds;
+    bool precomputed;
     size_t patch_rows;
     size_t patch_cols;
     double aspect_ratio;
@@ -36,8 +45,11 @@ class coastnet_dataset
         const bool init_ap_enabled,
         const size_t samples_per_class,
         const bool verbose,
-        RNG &init_rng)
-        : patch_rows (init_patch_rows)
+        RNG &init_rng,
+        const bool precompute_rasters = true,
+        const size_t threads = 0)
+        : precomputed (precompute_rasters)
+        , patch_rows (init_patch_rows)
         , patch_cols (init_patch_cols)
         , aspect_ratio (init_aspect_ratio)
         , ap (init_ap)
@@ -46,6 +58,9 @@ class coastnet_dataset
     {
         using namespace std;
 
+        // 0 threads means use all available threads
+        const int nthreads = threads == 0 ? omp_get_max_threads () : threads;
+
         // One dataset per input file
         datasets.resize (fns.size ());
 
@@ -57,19 +72,27 @@ class coastnet_dataset
             if (verbose)
                 clog << "Reading " << fn << endl;
 
-            // Read the points
-            const auto df = ATL24_coastnet::dataframe::read (fn);
+            // Read the points, but only the columns used for training
+            const auto df = ATL24_coastnet::dataframe::read (fn,
+                { PI_NAME, X_NAME, Z_NAME, LABEL_NAME },
+                {
+                    { PI_NAME, columnar::column_type::int64 },
+                    { LABEL_NAME, columnar::column_type::uint8 },
+                },
+                threads);
 
             // Convert it to the correct format
-            datasets[i] = convert_dataframe (df);
+            datasets[i] = convert_dataframe (df, threads);
 
             if (verbose)
                 clog << datasets[i].size () << " points read" << endl;
 
             // Sort them by X
-            sort (datasets[i].begin (), datasets[i].end (),
-                [](const auto &a, const auto &b)
-                { return a.x < b.x; });
+            ordering::ordering_params op;
+            op.threads = threads;
+            const auto order = ordering::get_x_order (datasets[i], op);
+            if (!order.empty ())
+                ordering::gather_in_place (datasets[i], order);
         }
 
         // Get sample indexes of points in each class
@@ -104,35 +127,77 @@ class coastnet_dataset
         // Randomize the order
         shuffle (sample_indexes.begin (), sample_indexes.end (), rng);
 
-        if (verbose)
-            clog << "Creating rasters..." << endl;
-
-        // Allocate vector
-        rasters.resize (sample_indexes.size ());
-
         // Create seeds
-        vector<size_t> random_seeds (rasters.size ());
+        random_seeds.resize (sample_indexes.size ());
         for (size_t i = 0; i < random_seeds.size (); ++i)
             random_seeds[i] = rng ();
 
-        using namespace ATL24_coastnet::raster;
+        // Get the elevations, the first feature of each sample
+        elevations.resize (sample_indexes.size ());
+        for (size_t i = 0; i < elevations.size (); ++i)
+            elevations[i] = get_elevation (i);
 
-#pragma omp parallel for
-        for (size_t i = 0; i < rasters.size (); ++i)
+        // The rasters can instead be created when they are needed, so
+        // that they don't all have to fit in memory
+        if (!precomputed)
         {
-            const auto dataset_index = sample_indexes[i].dataset_index;
-            const auto point_index = sample_indexes[i].point_index;
-            assert (dataset_index < datasets.size ());
-            assert (point_index < datasets[dataset_index].size ());
-            rasters[i] = create_raster (
-                datasets[dataset_index],
-                point_index,
-                patch_rows,
-                patch_cols,
-                aspect_ratio,
-                ap,
-                ap_enabled,
-                random_seeds[i]);
+            if (verbose)
+                clog << "Total samples: " << sample_indexes.size () << endl;
+            return;
+        }
+
+        if (verbose)
+            clog << "Creating rasters..." << endl;
+
+        // Allocate the slab
+        const size_t patch_size = patch_rows * patch_cols;
+        patch_pitch = (patch_size + patch_alignment - 1) / patch_alignment * patch_alignment;
+        patches.resize (sample_indexes.size () * patch_pitch);
+
+        // Visit the samples in track order so that the patch
+        // boundaries only move forward along each track
+        vector<size_t> order (sample_indexes.size ());
+        iota (order.begin (), order.end (), 0);
+        sort (order.begin (), order.end (),
+            [&](const auto &a, const auto &b)
+            {
+                const auto &sa = sample_indexes[a];
+                const auto &sb = sample_indexes[b];
+                return tie (sa.dataset_index, sa.point_index) < tie (sb.dataset_index, sb.point_index);
+            });
+
+#pragma omp parallel num_threads(nthreads)
+        {
+            // Each thread keeps a patch builder for the track it is on,
+            // and a raster to build each patch in
+            optional<patch_builder<vector<classified_point2d>>> pb;
+            size_t current_dataset = datasets.size ();
+            raster::raster<unsigned char> r (patch_rows, patch_cols);
+
+#pragma omp for schedule(static)
+            for (size_t n = 0; n < order.size (); ++n)
+            {
+                const size_t i = order[n];
+                const auto dataset_index = sample_indexes[i].dataset_index;
+                const auto point_index = sample_indexes[i].point_index;
+                assert (dataset_index < datasets.size ());
+                assert (point_index < datasets[dataset_index].size ());
+
+                // Switch tracks
+                if (dataset_index != current_dataset)
+                {
+                    pb.emplace (datasets[dataset_index], patch_rows, patch_cols, aspect_ratio);
+                    current_dataset = dataset_index;
+                }
+
+                pb->create_raster (
+                    point_index,
+                    r,
+                    ap,
+                    ap_enabled,
+                    random_seeds[i]);
+                copy (r.begin (), r.end (), &patches[i * patch_pitch]);
+            }
         }
 
         // Show results
@@ -144,8 +209,44 @@ class coastnet_dataset
     {
         using namespace std;
 
-        assert (index < rasters.size ());
-        return rasters[index];
+        if (precomputed)
+        {
+            assert (index < sample_indexes.size ());
+            const uint8_t *p = &patches[index * patch_pitch];
+            raster::raster<unsigned char> r (patch_rows, patch_cols);
+            copy (p, p + r.size (), r.begin ());
+            return r;
+        }
+
+        // Create the same raster that would have been precomputed
+        assert (index < sample_indexes.size ());
+        const auto dataset_index = sample_indexes[index].dataset_index;
+        const auto point_index = sample_indexes[index].point_index;
+        return create_raster (datasets[dataset_index],
+            point_index,
+            patch_rows,
+            patch_cols,
+            aspect_ratio,
+            ap,
+            ap_enabled,
+            random_seeds[index]);
+    }
+
+    // Get the features of all the samples, without copying them
+    //
+    // The rasters must have been precomputed.
+    xgboost::patch_features get_patch_features () const
+    {
+        // Check invariants
+        assert (precomputed);
+
+        xgboost::patch_features f;
+        f.rows = sample_indexes.size ();
+        f.elevations = elevations.data ();
+        f.cells = patches.data ();
+        f.cells_per_row = patch_rows * patch_cols;
+        f.pitch = patch_pitch;
+        return f;
     }
 
     unsigned get_label (size_t index) const
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "precompiled.h"
+#include "csv_writer.h"
+#include "columnar.h"
+#include "mapped_file.h"
 
 namespace ATL24_coastnet
 {
@@ -8,12 +11,53 @@ namespace ATL24_coastnet
 namespace dataframe
 {
 
+using columnar::column_type;
+
+// A column of values
+//
+// The alternatives are in the same order as 'column_type', so
+// 'column.index ()' is the column's type.
+using column = std::variant<
+    std::vector<double>,
+    std::vector<float>,
+    std::vector<int64_t>,
+    std::vector<int32_t>,
+    std::vector<uint8_t>>;
+
+static_assert (std::is_same_v<std::variant_alternative_t<size_t (column_type::float64), column>, std::vector<double>>);
+static_assert (std::is_same_v<std::variant_alternative_t<size_t (column_type::float32), column>, std::vector<float>>);
+static_assert (std::is_same_v<std::variant_alternative_t<size_t (column_type::int64), column>, std::vector<int64_t>>);
+static_assert (std::is_same_v<std::variant_alternative_t<size_t (column_type::int32), column>, std::vector<int32_t>>);
+static_assert (std::is_same_v<std::variant_alternative_t<size_t (column_type::uint8), column>, std::vector<uint8_t>>);
+
+// Create a column of 'n' zeroes
+inline column make_column (const column_type t, const size_t n)
+{
+    switch (t)
+    {
+        case column_type::float64: return std::vector<double> (n);
+        case column_type::float32: return std::vector<float> (n);
+        case column_type::int64: return std::vector<int64_t> (n);
+        case column_type::int32: return std::vector<int32_t> (n);
+        case column_type::uint8: return std::vector<uint8_t> (n);
+    }
+    throw std::runtime_error ("Unknown column type");
+}
+
+// Declared column types, by column name
+using column_types = std::unordered_map<std::string,column_type>;
+
+inline size_t column_size (const column &c)
+{
+    return std::visit ([] (const auto &v) { return v.size (); }, c);
+}
+
 class dataframe
 {
     private:
     std::vector<std::string> headers;
     std::unordered_map<std::string,size_t> header_column;
-    std::vector<std::vector<double>> columns;
+    std::vector<column> columns;
 
     public:
     bool is_valid () const
@@ -26,7 +70,7 @@ class dataframe
             return false;
         // Number of rows are the same in each column
         for (size_t i = 1; i < columns.size (); ++i)
-            if (columns[i].size () != columns[0].size ())
+            if (column_size (columns[i]) != column_size (columns[0]))
                 return false;
         return true;
     }
@@ -42,9 +86,9 @@ class dataframe
     size_t rows () const
     {
         assert (is_valid ());
-        return columns.empty () ? 0 : columns[0].size ();
+        return columns.empty () ? 0 : column_size (columns[0]);
     }
-    void add_column (const std::string &name, const std::vector<double> &new_column)
+    void add_column (const std::string &name, column new_column)
     {
         // Does this column already exist?
         if (header_column.find (name) != header_column.end ())
@@ -52,28 +96,40 @@ class dataframe
         assert (is_valid ());
         // Add the column
         headers.push_back (name);
-        columns.push_back (new_column);
+        columns.push_back (std::move (new_column));
         // Update header column map
         header_column[name] = headers.size () - 1;
         assert (is_valid ());
     }
-    void add_column (const std::string &name)
+    void add_column (const std::string &name, const std::vector<double> &new_column)
     {
-        const std::vector<double> zeroes (rows ());
-        add_column (name, zeroes);
+        add_column (name, column (new_column));
+    }
+    void add_column (const std::string &name, const column_type t = column_type::float64)
+    {
+        add_column (name, make_column (t, rows ()));
     }
     void set_rows (const size_t n)
     {
         assert (is_valid ());
-        for (size_t i = 0; i < columns.size (); ++i)
-            columns[i].resize (n);
+        for (auto &c : columns)
+            std::visit ([&] (auto &v) { v.resize (n); }, c);
         assert (is_valid ());
     }
+    column_type get_type (const size_t col) const
+    {
+        assert (col < columns.size ());
+        return column_type (columns[col].index ());
+    }
+    column_type get_type (const std::string &name) const
+    {
+        return get_type (get_column_index (name));
+    }
     double get_value (const size_t col, const size_t row) const
     {
         assert (col < columns.size ());
-        assert (row < columns[col].size ());
-        return columns[col][row];
+        assert (row < column_size (columns[col]));
+        return std::visit ([&] (const auto &v) { return double (v[row]); }, columns[col]);
     }
     double get_value (const std::string &name, const size_t row) const
     {
@@ -82,23 +138,79 @@ class dataframe
         const size_t col = header_column.at (name);
         return get_value (col, row);
     }
+    bool has_column (const std::string &name) const
+    {
+        return header_column.find (name) != header_column.end ();
+    }
+    // Resolve a column name once, so that its values can be accessed
+    // without a lookup per value
+    size_t get_column_index (const std::string &name) const
+    {
+        const auto it = header_column.find (name);
+        if (it == header_column.end ())
+            throw std::runtime_error ("Can't find '" + name + "' in dataframe");
+        return it->second;
+    }
+    // Get the values in a column of type 'T'
+    template<typename T = double>
+    std::span<const T> get_column (const size_t col) const
+    {
+        assert (col < columns.size ());
+        const auto v = std::get_if<std::vector<T>> (&columns[col]);
+        if (v == nullptr)
+            throw std::runtime_error ("Column '" + headers[col] + "' is " + columnar::type_name (get_type (col))
+                + ", not " + columnar::type_name (columnar::get_column_type<T> ()));
+        return *v;
+    }
+    template<typename T = double>
+    std::span<const T> get_column (const std::string &name) const
+    {
+        return get_column<T> (get_column_index (name));
+    }
+    // Call 'f' with the values in a column, as a span of their type
+    template<typename F>
+    void visit_column (const size_t col, const F &f) const
+    {
+        assert (col < columns.size ());
+        std::visit ([&] (const auto &v)
+        {
+            f (std::span<const typename std::remove_cvref_t<decltype (v)>::value_type> (v));
+        }, columns[col]);
+    }
+    // Set a value, converting it to the column's type
     void set_value (const std::string &name, const size_t row, const double x)
     {
         // Make sure column name exists
         assert (header_column.find (name) != header_column.end ());
         const size_t col = header_column.at (name);
         assert (col < columns.size ());
-        assert (row < columns[col].size ());
-        columns[col][row] = x;
+        assert (row < column_size (columns[col]));
+        std::visit ([&] (auto &v)
+        {
+            v[row] = static_cast<typename std::remove_cvref_t<decltype (v)>::value_type> (x);
+        }, columns[col]);
     }
-    void set_values (std::vector<std::vector<double>> values)
+    void set_column (const size_t col, column values)
+    {
+        assert (col < columns.size ());
+        assert (column_size (values) == rows ());
+        columns[col] = std::move (values);
+    }
+    void set_values (std::vector<column> values)
     {
         assert (values.size () == headers.size ());
         assert (values.size () == columns.size ());
         for (size_t i = 0; i < columns.size (); ++i)
-            columns[i] = values[i];
+            columns[i] = std::move (values[i]);
         assert (is_valid ());
     }
+    void set_values (std::vector<std::vector<double>> values)
+    {
+        std::vector<column> tmp;
+        for (auto &v : values)
+            tmp.push_back (std::move (v));
+        set_values (std::move (tmp));
+    }
     friend bool operator ==(const dataframe &a, const dataframe &b)
     {
         if (a.headers != b.headers)
@@ -111,7 +223,416 @@ class dataframe
     }
 };
 
-dataframe read (std::istream &is)
+namespace detail
+{
+
+// Parse one value the way strtod () does, and advance 'p' past it
+//
+// Plain decimal values are parsed with from_chars (). Anything that
+// from_chars () might parse differently, like leading whitespace, a
+// leading '+', hex, or a value that is out of range, falls back to
+// strtod ().
+inline double parse_value (const char *&p, const char *end)
+{
+    using namespace std;
+
+    if (p != end && (isdigit (*p) || *p == '-' || *p == '.'))
+    {
+        double x;
+        const auto r = from_chars (p, end, x);
+        if (r.ec == errc () && (r.ptr == end || *r.ptr == ',' || *r.ptr == '\r'))
+        {
+            p = r.ptr;
+            return x;
+        }
+    }
+
+    // strtod () needs a terminated string
+    const string s (p, end);
+    char *e;
+    const double x = strtod (s.c_str (), &e);
+    p += e - s.c_str ();
+    return x;
+}
+
+// Can the integer column type 'T' hold 'x' exactly?
+template<typename T>
+bool holds_integer (const double x)
+{
+    using namespace std;
+
+    // T's range is [min, 2^digits)
+    return x == trunc (x)
+        && x >= double (numeric_limits<T>::min ())
+        && x < ldexp (1.0, numeric_limits<T>::digits);
+}
+
+// Parse one value of an integer column, and advance 'p' past it
+//
+// Integers are parsed exactly, even if they can't be held in a double.
+// Anything else is parsed as a double, which must hold an integer in the
+// range of 'T', so that "40.0000" is read as 40. Returns false if the
+// value doesn't fit.
+template<typename T>
+bool parse_integer (const char *&p, const char *end, T &x)
+{
+    using namespace std;
+
+    if (p != end && (isdigit (*p) || *p == '-'))
+    {
+        int64_t i;
+        const auto r = from_chars (p, end, i);
+        if (r.ec == errc () && (r.ptr == end || *r.ptr == ',' || *r.ptr == '\r') && in_range<T> (i))
+        {
+            p = r.ptr;
+            x = T (i);
+            return true;
+        }
+    }
+
+    const double d = parse_value (p, end);
+    if (!holds_integer<T> (d))
+        return false;
+    x = T (d);
+    return true;
+}
+
+// Parse one value into 'row' of a column of type 't' at 'data'
+//
+// Returns false if the value doesn't fit in the column's type.
+inline bool parse_field (const char *&p, const char *end, const column_type t, void *data, const size_t row)
+{
+    switch (t)
+    {
+        case column_type::float64: static_cast<double *> (data)[row] = parse_value (p, end); return true;
+        case column_type::float32: static_cast<float *> (data)[row] = parse_value (p, end); return true;
+        case column_type::int64: return parse_integer (p, end, static_cast<int64_t *> (data)[row]);
+        case column_type::int32: return parse_integer (p, end, static_cast<int32_t *> (data)[row]);
+        case column_type::uint8: return parse_integer (p, end, static_cast<uint8_t *> (data)[row]);
+    }
+    assert (false);
+    return false;
+}
+
+// Get the declared type of a column, float64 if it's not declared
+inline column_type get_declared_type (const column_types &types, const std::string &name)
+{
+    const auto it = types.find (name);
+    return it == types.end () ? column_type::float64 : it->second;
+}
+
+// Parse the column headers from the first line
+inline dataframe parse_headers (const std::string &line)
+{
+    using namespace std;
+
+    dataframe df;
+
+    // Parse each individual column header
+    stringstream ss (line);
+    string header;
+    while (getline (ss, header, ','))
+    {
+        // Remove LFs in case the file was created under Windows
+        std::erase (header, '\r');
+
+        // Create it
+        df.add_column (header);
+    }
+
+    return df;
+}
+
+// Get the columns of 'headers' that are in 'columns'
+//
+// An empty 'columns' selects all of them.
+inline std::vector<bool> select_columns (const std::vector<std::string> &headers,
+    const std::vector<std::string> &columns)
+{
+    using namespace std;
+
+    vector<bool> selected (headers.size (), columns.empty ());
+    for (size_t j = 0; j < headers.size (); ++j)
+        if (find (columns.begin (), columns.end (), headers[j]) != columns.end ())
+            selected[j] = true;
+    return selected;
+}
+
+// Parse CSV text in [begin, end)
+//
+// The text is split into newline aligned chunks of about 'chunk_size'
+// bytes. The rows in each chunk are counted, so the columns can be
+// sized, and then the chunks are parsed in parallel.
+//
+// Only the columns in 'columns' are kept, or all of them if it's empty.
+// The other fields are skipped up to the next ',' without being parsed.
+//
+// Columns in 'types' are stored as that type, and the rest as float64.
+//
+// The chunks are parsed by 'threads' threads, 0 means use all available
+// threads.
+inline dataframe parse (const char *begin,
+    const char *end,
+    const size_t chunk_size = 1 << 22,
+    const std::vector<std::string> &columns = {},
+    const column_types &types = {},
+    const size_t threads = 0)
+{
+    using namespace std;
+
+    assert (chunk_size != 0);
+
+    const int nthreads = threads == 0 ? omp_get_max_threads () : threads;
+
+    // Empty input has no headers
+    if (begin == end)
+        return dataframe ();
+
+    // Read the headers
+    const char *p = find (begin, end, '\n');
+    const auto headers = parse_headers (string (begin, p)).get_headers ();
+    if (p != end)
+        ++p;
+
+    // Get the columns to keep
+    const auto selected = select_columns (headers, columns);
+    dataframe df;
+    for (size_t j = 0; j < headers.size (); ++j)
+        if (selected[j])
+            df.add_column (headers[j], get_declared_type (types, headers[j]));
+
+    // Fields after the last selected column don't need to be looked at
+    const size_t fields = find (selected.rbegin (), selected.rend (), true).base () - selected.begin ();
+
+    // Split the rest into chunks that end on a newline
+    vector<const char *> chunks { p };
+    while (chunks.back () != end)
+    {
+        const char *q = chunks.back () + std::min (chunk_size, size_t (end - chunks.back ()));
+        q = find (q - 1, end, '\n');
+        chunks.push_back (q == end ? end : q + 1);
+    }
+    const size_t total_chunks = chunks.size () - 1;
+
+    // Get the first row of each chunk
+    vector<size_t> offsets (total_chunks + 1);
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for (size_t i = 0; i < total_chunks; ++i)
+    {
+        size_t rows = 0;
+        for (const char *line = chunks[i]; line != chunks[i + 1]; )
+        {
+            const char *line_end = find (line, chunks[i + 1], '\n');
+
+            // Skip empty lines
+            if (line_end != line)
+                ++rows;
+            line = line_end == chunks[i + 1] ? line_end : line_end + 1;
+        }
+        offsets[i + 1] = rows;
+    }
+    partial_sum (offsets.begin (), offsets.end (), offsets.begin ());
+
+    // Allocate the columns, and get pointers to their values
+    const size_t cols = df.cols ();
+    vector<column> values (cols);
+    vector<void *> data (cols);
+    for (size_t k = 0; k < cols; ++k)
+    {
+        values[k] = make_column (df.get_type (k), offsets.back ());
+        data[k] = visit ([] (auto &v) -> void * { return v.data (); }, values[k]);
+    }
+
+    // Now get the rows, and remember the first value in each chunk that
+    // didn't fit its column
+    const size_t npos = numeric_limits<size_t>::max ();
+    vector<size_t> bad_column (total_chunks, npos);
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+    for (size_t i = 0; i < total_chunks; ++i)
+    {
+        size_t row = offsets[i];
+        for (const char *line = chunks[i]; line != chunks[i + 1]; )
+        {
+            const char *line_end = find (line, chunks[i + 1], '\n');
+
+            // Skip empty lines
+            if (line_end != line)
+            {
+                const char *q = line;
+                for (size_t j = 0, k = 0; j < fields; ++j)
+                {
+                    if (!selected[j])
+                        q = find (q, line_end, ',');
+                    else if (!parse_field (q, line_end, df.get_type (k), data[k], row) && bad_column[i] == npos)
+                        bad_column[i] = k;
+                    if (selected[j])
+                        ++k;
+                    // Ignore ','
+                    if (q != line_end && *q == ',')
+                        ++q;
+                }
+                ++row;
+            }
+            line = line_end == chunks[i + 1] ? line_end : line_end + 1;
+        }
+        assert (row == offsets[i + 1]);
+    }
+
+    for (auto k : bad_column)
+        if (k != npos)
+            throw runtime_error ("Column '" + df.get_headers ()[k] + "' has a value that is not "
+                + columnar::type_name (df.get_type (k)));
+
+    // Move the data to the dataframe
+    df.set_values (std::move (values));
+    assert (df.is_valid ());
+
+    return df;
+}
+
+// Copy the columns in 'columns' from a columnar table into a dataframe
+//
+// An empty 'columns' copies all of them. Columns keep their stored
+// type, unless they are in 'types'.
+//
+// The columns are copied by 'threads' threads, 0 means use all
+// available threads.
+inline dataframe convert_table (const columnar::table &t,
+    const std::vector<std::string> &columns = {},
+    const column_types &types = {},
+    const size_t threads = 0)
+{
+    using namespace std;
+
+    const int nthreads = threads == 0 ? omp_get_max_threads () : threads;
+
+    const auto headers = t.get_headers ();
+    const auto selected = select_columns (headers, columns);
+    dataframe df;
+    vector<size_t> cols;
+    for (size_t j = 0; j < headers.size (); ++j)
+    {
+        if (!selected[j])
+            continue;
+        const auto it = types.find (headers[j]);
+        df.add_column (headers[j], it == types.end () ? t.get_type (j) : it->second);
+        cols.push_back (j);
+    }
+
+    vector<column> values (cols.size ());
+    vector<char> bad (cols.size ());
+
+#pragma omp parallel for num_threads(nthreads)
+    for (size_t k = 0; k < cols.size (); ++k)
+    {
+        values[k] = make_column (df.get_type (k), t.rows ());
+        visit ([&] (auto &v)
+        {
+            using T = typename remove_cvref_t<decltype (v)>::value_type;
+            if (t.get_type (cols[k]) == columnar::get_column_type<T> ())
+            {
+                // Same type, just copy it
+                const auto c = t.get_column<T> (cols[k]);
+                copy (c.begin (), c.end (), v.begin ());
+                return;
+            }
+            for (size_t i = 0; i < t.rows (); ++i)
+            {
+                const double x = t.get_value (cols[k], i);
+                if constexpr (is_integral_v<T>)
+                {
+                    if (!holds_integer<T> (x))
+                    {
+                        bad[k] = true;
+                        return;
+                    }
+                }
+                v[i] = T (x);
+            }
+        }, values[k]);
+    }
+
+    for (size_t k = 0; k < cols.size (); ++k)
+        if (bad[k])
+            throw runtime_error ("Column '" + headers[cols[k]] + "' has a value that is not "
+                + columnar::type_name (df.get_type (k)));
+
+    df.set_values (std::move (values));
+    assert (df.is_valid ());
+
+    return df;
+}
+
+} // namespace detail
+
+// Read a dataframe from a CSV or columnar stream
+//
+// The whole stream is read into memory. CSV streams are parsed in
+// parallel.
+//
+// If 'columns' is not empty, only those columns are read. Columns in
+// 'types' are read as that type. At most 'threads' threads are used, 0
+// means use all available threads.
+dataframe read (std::istream &is,
+    const std::vector<std::string> &columns = {},
+    const column_types &types = {},
+    const size_t threads = 0)
+{
+    using namespace std;
+
+    vector<char> s;
+    vector<char> buffer (1 << 20);
+    while (is.read (&buffer[0], buffer.size ()) || is.gcount () != 0)
+        s.insert (s.end (), buffer.begin (), buffer.begin () + is.gcount ());
+
+    if (columnar::is_columnar (s.data (), s.data () + s.size ()))
+        return detail::convert_table (columnar::table (std::move (s)), columns, types, threads);
+
+    return detail::parse (s.data (), s.data () + s.size (), 1 << 22, columns, types, threads);
+}
+
+// Read a dataframe from a CSV or columnar file
+//
+// Regular files are memory mapped, and anything else, like a pipe, is
+// read like a stream. CSV files are parsed in parallel.
+//
+// If 'columns' is not empty, only those columns are read, and the rest
+// are skipped. Columns that are not in the file are ignored.
+//
+// Columns in 'types' are read as that type. Other CSV columns are read
+// as float64, and other columnar columns keep their stored type. A value
+// that doesn't fit its declared type is an error.
+//
+// At most 'threads' threads are used, 0 means use all available threads.
+dataframe read (const std::string &fn,
+    const std::vector<std::string> &columns = {},
+    const column_types &types = {},
+    const size_t threads = 0)
+{
+    using namespace std;
+
+    // Pipes can't be mapped, so they are read like any other stream
+    if (!is_regular_file (fn))
+    {
+        ifstream ifs (fn, ios::binary);
+        if (!ifs)
+            throw runtime_error ("Could not open file for reading");
+        return read (ifs, columns, types, threads);
+    }
+
+    if (columnar::is_columnar (fn))
+        return detail::convert_table (columnar::table (fn), columns, types, threads);
+
+    const mapped_file f (fn);
+
+    return detail::parse (f.begin (), f.end (), 1 << 22, columns, types, threads);
+}
+
+// Read a dataframe from a CSV stream, one line at a time
+//
+// This is slower than read (), but it does not need to hold the whole
+// stream in memory.
+dataframe read_by_line (std::istream &is)
 {
     using namespace std;
 
@@ -166,17 +687,6 @@ dataframe read (std::istream &is)
     return df;
 }
 
-dataframe read (const std::string &fn)
-{
-    using namespace std;
-
-    ifstream ifs (fn);
-    if (!ifs)
-        throw runtime_error ("Could not open file for reading");
-
-    return ATL24_coastnet::dataframe::read (ifs);
-}
-
 std::ostream &write (std::ostream &os, const dataframe &df, const size_t precision = 16)
 {
     using namespace std;
@@ -206,29 +716,23 @@ std::ostream &write (std::ostream &os, const dataframe &df, const size_t precisi
     if (nrows == 0)
         return os;
 
-    // Save format
-    const auto f = os.flags();
-    const auto p = os.precision();
-
-    // Set format
-    os << std::fixed;
-    os << std::setprecision (precision);
-
-    // Write it out
-    for (size_t i = 0; i < nrows; ++i)
+    // Write it out. Integer columns are written as integers.
+    csv::write_rows (os, nrows, [&](string &s, const size_t i)
     {
         for (size_t j = 0; j < ncols; ++j)
         {
             if (j != 0)
-                os << ",";
-            os << df.get_value (j, i);
+                s += ',';
+            df.visit_column (j, [&] (const auto values)
+            {
+                if constexpr (is_integral_v<typename decltype (values)::value_type>)
+                    csv::append_integer (s, int64_t (values[i]));
+                else
+                    csv::append_fixed (s, values[i], precision);
+            });
         }
-        os << endl;
-    }
-
-    // Restore format
-    os.precision (p);
-    os.flags (f);
+        s += '\n';
+    });
 
     return os;
 }
@@ -244,6 +748,69 @@ std::ostream &write (const std::string &filename, const dataframe &df, const siz
     return write (ofs, df, precision);
 }
 
+// Write a dataframe as a columnar table
+//
+// Each column is stored as its own type.
+std::ostream &write_columnar (std::ostream &os, const dataframe &df)
+{
+    using namespace std;
+
+    assert (df.is_valid ());
+
+    const auto headers = df.get_headers ();
+    columnar::writer w (df.rows ());
+    for (size_t j = 0; j < df.cols (); ++j)
+        df.visit_column (j, [&] (const auto values) { w.add_column (headers[j], values); });
+
+    return w.write (os);
+}
+
+std::ostream &write_columnar (const std::string &filename, const dataframe &df)
+{
+    using namespace std;
+
+    ofstream ofs (filename, ios::binary);
+    if (!ofs)
+        throw runtime_error ("Can't open file for writing");
+
+    return write_columnar (ofs, df);
+}
+
+// Store float64 columns that only hold integers as the smallest integer
+// type that holds all of their values
+//
+// Columns that are empty, or that hold a NaN, a fraction, or a -0.0,
+// are not changed.
+inline void infer_types (dataframe &df)
+{
+    using namespace std;
+
+    for (size_t j = 0; j < df.cols (); ++j)
+    {
+        if (df.get_type (j) != column_type::float64 || df.rows () == 0)
+            continue;
+
+        const auto values = df.get_column<double> (j);
+        auto fits = [&]<typename T> ()
+        {
+            return all_of (values.begin (), values.end (), [] (const double x)
+                { return detail::holds_integer<T> (x) && !(x == 0.0 && signbit (x)); });
+        };
+
+        column c;
+        if (fits.template operator()<uint8_t> ())
+            c = vector<uint8_t> (values.begin (), values.end ());
+        else if (fits.template operator()<int32_t> ())
+            c = vector<int32_t> (values.begin (), values.end ());
+        else if (fits.template operator()<int64_t> ())
+            c = vector<int64_t> (values.begin (), values.end ());
+        else
+            continue;
+
+        df.set_column (j, std::move (c));
+    }
+}
+
 std::ostream &operator<< (std::ostream &os, const dataframe &df)
 {
     return write (os , df);
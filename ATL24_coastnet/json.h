@@ -0,0 +1,426 @@
+#pragma once
+
+#include "precompiled.h"
+
+namespace ATL24_coastnet
+{
+
+namespace json
+{
+
+/// @brief A parsed JSON value
+///
+/// This is just enough JSON to read and rewrite saved XGBoost models.
+///
+/// Numbers and strings keep their original text, so a value that is
+/// parsed and dumped again is reproduced exactly, and no precision is
+/// lost on the model's floating point values.
+class value
+{
+    public:
+    enum class type { null, boolean, number, string, array, object };
+
+    value () : t (type::null) { }
+    explicit value (const type init_t) : t (init_t) { }
+
+    type get_type () const { return t; }
+    bool is_null () const { return t == type::null; }
+    bool is_boolean () const { return t == type::boolean; }
+    bool is_number () const { return t == type::number; }
+    bool is_string () const { return t == type::string; }
+    bool is_array () const { return t == type::array; }
+    bool is_object () const { return t == type::object; }
+
+    /// @brief Number of elements in an array or object
+    size_t size () const
+    {
+        return children.size ();
+    }
+    /// @brief Array access
+    const value &operator[] (const size_t i) const
+    {
+        assert (is_array ());
+        assert (i < children.size ());
+        return children[i];
+    }
+    /// @brief Array access
+    value &operator[] (const size_t i)
+    {
+        assert (is_array ());
+        assert (i < children.size ());
+        return children[i];
+    }
+    /// @brief Check for an object member
+    bool contains (const std::string &key) const
+    {
+        return is_object () && std::find (keys.begin (), keys.end (), key) != keys.end ();
+    }
+    /// @brief Object access
+    ///
+    /// Throws if the member does not exist.
+    const value &operator[] (const std::string &key) const
+    {
+        return children[find (key)];
+    }
+    /// @brief Object access
+    ///
+    /// Throws if the member does not exist.
+    value &operator[] (const std::string &key)
+    {
+        return children[find (key)];
+    }
+    /// @brief Get a boolean, or a number used as a boolean
+    bool as_boolean () const
+    {
+        if (is_boolean ())
+            return text == "true";
+        return as_number () != 0.0;
+    }
+    /// @brief Get a number, or a string that holds a number
+    ///
+    /// XGBoost writes some numeric parameters as strings.
+    double as_number () const
+    {
+        if (!is_number () && !is_string ())
+            throw std::runtime_error ("JSON value is not a number");
+        if (text == "NaN")
+            return std::numeric_limits<double>::quiet_NaN ();
+        return std::strtod (text.c_str (), nullptr);
+    }
+    /// @brief Get a number as a float
+    ///
+    /// XGBoost writes single precision values with the fewest digits
+    /// that round trip, so they must be parsed directly as floats,
+    /// not as doubles that then get rounded.
+    float as_float () const
+    {
+        if (!is_number () && !is_string ())
+            throw std::runtime_error ("JSON value is not a number");
+        if (text == "NaN")
+            return std::numeric_limits<float>::quiet_NaN ();
+        if (text == "Infinity")
+            return std::numeric_limits<float>::infinity ();
+        if (text == "-Infinity")
+            return -std::numeric_limits<float>::infinity ();
+        float f = 0.0f;
+        const auto r = std::from_chars (text.data (), text.data () + text.size (), f);
+        if (r.ec != std::errc () || r.ptr != text.data () + text.size ())
+            throw std::runtime_error ("JSON value is not a valid float: " + text);
+        return f;
+    }
+    /// @brief Get a string
+    const std::string &as_string () const
+    {
+        if (!is_string ())
+            throw std::runtime_error ("JSON value is not a string");
+        return text;
+    }
+    /// @brief Set a boolean, preserving the value's representation
+    ///
+    /// If the value was stored as a number, it stays a number (0/1).
+    void set_boolean (const bool b)
+    {
+        using namespace std;
+
+        // Assigning the literals directly trips a bogus
+        // -Wstringop-overflow in GCC 12 when this is inlined
+        if (is_number ())
+            text = string (b ? "1" : "0");
+        else
+        {
+            t = type::boolean;
+            text = string (b ? "true" : "false");
+        }
+    }
+    /// @brief Set a string
+    void set_string (const std::string &s)
+    {
+        t = type::string;
+        text = s;
+    }
+
+    friend std::ostream &dump (std::ostream &os, const value &v);
+    friend class parser;
+
+    private:
+    type t;
+    // Literal text of a boolean or number, or the unescaped contents
+    // of a string
+    std::string text;
+    // Array elements or object member values
+    std::vector<value> children;
+    // Object member names
+    std::vector<std::string> keys;
+
+    size_t find (const std::string &key) const
+    {
+        if (!is_object ())
+            throw std::runtime_error ("JSON value is not an object");
+        const auto it = std::find (keys.begin (), keys.end (), key);
+        if (it == keys.end ())
+            throw std::runtime_error (std::string ("JSON object has no member named '") + key + "'");
+        return it - keys.begin ();
+    }
+};
+
+class parser
+{
+    public:
+    explicit parser (const std::string &init_s)
+        : s (init_s)
+        , pos (0)
+    {
+    }
+    value parse ()
+    {
+        value v = parse_value ();
+        skip_whitespace ();
+        if (pos != s.size ())
+            fail ("unexpected trailing characters");
+        return v;
+    }
+
+    private:
+    const std::string &s;
+    size_t pos;
+
+    [[noreturn]] void fail (const std::string &msg) const
+    {
+        throw std::runtime_error ("JSON parse error at offset " + std::to_string (pos) + ": " + msg);
+    }
+    void skip_whitespace ()
+    {
+        while (pos < s.size () && (s[pos] == ' ' || s[pos] == '\n' || s[pos] == '\r' || s[pos] == '\t'))
+            ++pos;
+    }
+    void expect (const char c)
+    {
+        skip_whitespace ();
+        if (pos >= s.size () || s[pos] != c)
+            fail (std::string ("expected '") + c + "'");
+        ++pos;
+    }
+    bool match (const std::string &literal)
+    {
+        if (s.compare (pos, literal.size (), literal) != 0)
+            return false;
+        pos += literal.size ();
+        return true;
+    }
+    std::string parse_string ()
+    {
+        expect ('"');
+        std::string str;
+        while (pos < s.size () && s[pos] != '"')
+        {
+            char c = s[pos++];
+            if (c == '\\')
+            {
+                if (pos >= s.size ())
+                    fail ("unterminated escape");
+                c = s[pos++];
+                switch (c)
+                {
+                    case 'b': c = '\b'; break;
+                    case 'f': c = '\f'; break;
+                    case 'n': c = '\n'; break;
+                    case 'r': c = '\r'; break;
+                    case 't': c = '\t'; break;
+                    case '"': case '\\': case '/': break;
+                    default: fail ("unsupported escape");
+                }
+            }
+            str.push_back (c);
+        }
+        if (pos >= s.size ())
+            fail ("unterminated string");
+        ++pos;
+        return str;
+    }
+    value parse_value ()
+    {
+        using namespace std;
+
+        skip_whitespace ();
+        if (pos >= s.size ())
+            fail ("unexpected end of input");
+
+        const char c = s[pos];
+        if (c == '{')
+        {
+            value v (value::type::object);
+            ++pos;
+            skip_whitespace ();
+            if (pos < s.size () && s[pos] == '}')
+            {
+                ++pos;
+                return v;
+            }
+            while (true)
+            {
+                v.keys.push_back (parse_string ());
+                expect (':');
+                v.children.push_back (parse_value ());
+                skip_whitespace ();
+                if (pos < s.size () && s[pos] == ',')
+                {
+                    ++pos;
+                    continue;
+                }
+                expect ('}');
+                return v;
+            }
+        }
+        if (c == '[')
+        {
+            value v (value::type::array);
+            ++pos;
+            skip_whitespace ();
+            if (pos < s.size () && s[pos] == ']')
+            {
+                ++pos;
+                return v;
+            }
+            while (true)
+            {
+                v.children.push_back (parse_value ());
+                skip_whitespace ();
+                if (pos < s.size () && s[pos] == ',')
+                {
+                    ++pos;
+                    continue;
+                }
+                expect (']');
+                return v;
+            }
+        }
+        if (c == '"')
+        {
+            value v (value::type::string);
+            v.text = parse_string ();
+            return v;
+        }
+        if (match ("true"))
+        {
+            value v (value::type::boolean);
+            v.text = "true";
+            return v;
+        }
+        if (match ("false"))
+        {
+            value v (value::type::boolean);
+            v.text = "false";
+            return v;
+        }
+        if (match ("null"))
+            return value ();
+
+        // Number, including the non-standard NaN and Infinity literals
+        // that XGBoost may write
+        const size_t start = pos;
+        if (match ("NaN") || match ("Infinity") || match ("-Infinity"))
+        {
+            value v (value::type::number);
+            v.text = s.substr (start, pos - start);
+            return v;
+        }
+        while (pos < s.size () && (isdigit (s[pos]) || s[pos] == '-' || s[pos] == '+' || s[pos] == '.' || s[pos] == 'e' || s[pos] == 'E'))
+            ++pos;
+        if (pos == start)
+            fail ("unexpected character");
+        value v (value::type::number);
+        v.text = s.substr (start, pos - start);
+        return v;
+    }
+};
+
+/// @brief Parse a JSON document
+value parse (const std::string &s)
+{
+    parser p (s);
+    return p.parse ();
+}
+
+/// @brief Parse a JSON file
+value read (const std::string &fn)
+{
+    using namespace std;
+
+    ifstream ifs (fn);
+    if (!ifs)
+        throw runtime_error ("Could not open file for reading");
+
+    stringstream ss;
+    ss << ifs.rdbuf ();
+    return parse (ss.str ());
+}
+
+/// @brief Write a JSON document
+std::ostream &dump (std::ostream &os, const value &v)
+{
+    switch (v.t)
+    {
+        case value::type::null:
+            os << "null";
+            break;
+        case value::type::boolean:
+        case value::type::number:
+            os << v.text;
+            break;
+        case value::type::string:
+            os << '"';
+            for (auto c : v.text)
+            {
+                switch (c)
+                {
+                    case '"': os << "\\\""; break;
+                    case '\\': os << "\\\\"; break;
+                    case '\b': os << "\\b"; break;
+                    case '\f': os << "\\f"; break;
+                    case '\n': os << "\\n"; break;
+                    case '\r': os << "\\r"; break;
+                    case '\t': os << "\\t"; break;
+                    default: os << c; break;
+                }
+            }
+            os << '"';
+            break;
+        case value::type::array:
+            os << '[';
+            for (size_t i = 0; i < v.children.size (); ++i)
+            {
+                if (i != 0)
+                    os << ',';
+                dump (os, v.children[i]);
+            }
+            os << ']';
+            break;
+        case value::type::object:
+            os << '{';
+            for (size_t i = 0; i < v.children.size (); ++i)
+            {
+                if (i != 0)
+                    os << ',';
+                value key (value::type::string);
+                key.text = v.keys[i];
+                dump (os, key);
+                os << ':';
+                dump (os, v.children[i]);
+            }
+            os << '}';
+            break;
+    }
+    return os;
+}
+
+/// @brief Write a JSON document to a string
+std::string dump (const value &v)
+{
+    std::stringstream ss;
+    dump (ss, v);
+    return ss.str ();
+}
+
+} // namespace json
+
+} // namespace ATL24_coastnet
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "precompiled.h"
+
+namespace ATL24_coastnet
+{
+
+// Is 'fn' a regular file?
+//
+// Pipes, FIFOs and devices like /dev/stdin report a size of 0, so they
+// can't be mapped, and reading from them consumes their contents.
+inline bool is_regular_file (const std::string &fn)
+{
+    struct stat sb;
+    return ::stat (fn.c_str (), &sb) == 0 && S_ISREG (sb.st_mode);
+}
+
+// Read-only memory map of a whole file
+class mapped_file
+{
+    public:
+    explicit mapped_file (const std::string &fn)
+        : fd (-1)
+        , ptr (nullptr)
+        , len (0)
+    {
+        using namespace std;
+
+        fd = ::open (fn.c_str (), O_RDONLY);
+        if (fd == -1)
+            throw runtime_error ("Could not open file for reading");
+
+        struct stat sb;
+        if (::fstat (fd, &sb) == -1)
+        {
+            ::close (fd);
+            throw runtime_error ("Could not get file size");
+        }
+        if (!S_ISREG (sb.st_mode))
+        {
+            ::close (fd);
+            throw runtime_error ("Only regular files can be mapped");
+        }
+        len = sb.st_size;
+
+        // Empty files can't be mapped
+        if (len == 0)
+            return;
+
+        ptr = ::mmap (nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED)
+        {
+            ::close (fd);
+            throw runtime_error ("Could not map file");
+        }
+        ::madvise (ptr, len, MADV_SEQUENTIAL);
+    }
+    ~mapped_file ()
+    {
+        if (ptr != nullptr)
+            ::munmap (ptr, len);
+        if (fd != -1)
+            ::close (fd);
+    }
+    mapped_file (const mapped_file &) = delete;
+    mapped_file &operator= (const mapped_file &) = delete;
+
+    const char *begin () const { return static_cast<const char *> (ptr); }
+    const char *end () const { return begin () + len; }
+    size_t size () const { return len; }
+
+    private:
+    int fd;
+    void *ptr;
+    size_t len;
+};
+
+} // namespace ATL24_coastnet
@@ -0,0 +1,312 @@
+#pragma once
+
+#include "precompiled.h"
+
+namespace ATL24_coastnet
+{
+
+// Put points in along-track order, and back again
+//
+// Photons usually arrive sorted by X, or nearly so, so getting the
+// order takes one of three paths:
+//
+//     1. A linear pass detects input that is already sorted, and
+//        returns an empty order.
+//     2. Input that is only locally out of order is insertion sorted,
+//        which takes time in proportion to how far the points have to
+//        move. The insertion sort gives up if they move too far.
+//     3. Anything else gets a parallel LSD radix sort on the bits of X.
+//
+// All three are stable, so points with the same X keep their original
+// order.
+//
+// The order is a permutation: order[i] is the index of the point that
+// belongs at position 'i'. gather_in_place () uses it to sort the
+// points, and scatter_in_place () uses it to put them back.
+namespace ordering
+{
+
+struct ordering_params
+{
+    // Give up on the insertion sort after this many moves per point
+    size_t insertion_sort_moves_per_point = 8;
+    // Threads for the radix sort, 0 = use all available threads
+    size_t threads = 0;
+};
+
+// Map a double to an unsigned key with the same ordering
+//
+// Positive values get their sign bit set, and negative values get all
+// their bits flipped. -0.0 is treated as 0.0, like the '<' operator
+// does.
+inline uint64_t get_radix_key (const double x)
+{
+    const uint64_t u = std::bit_cast<uint64_t> (x == 0.0 ? 0.0 : x);
+    const uint64_t sign = uint64_t (1) << 63;
+    return (u & sign) ? ~u : (u | sign);
+}
+
+namespace detail
+{
+
+// Stable insertion sort of 'order' by 'x'
+//
+// 'x' is sorted along with 'order'. Returns false, leaving both
+// partially sorted, if it takes more than 'max_moves' moves.
+inline bool insertion_sort (std::vector<double> &x,
+    std::vector<size_t> &order,
+    const size_t max_moves)
+{
+    // Check invariants
+    assert (x.size () == order.size ());
+
+    size_t moves = 0;
+    for (size_t i = 1; i < x.size (); ++i)
+    {
+        if (!(x[i] < x[i - 1]))
+            continue;
+
+        const double xi = x[i];
+        const size_t oi = order[i];
+        size_t j = i;
+        for ( ; j > 0 && xi < x[j - 1]; --j)
+        {
+            x[j] = x[j - 1];
+            order[j] = order[j - 1];
+        }
+        x[j] = xi;
+        order[j] = oi;
+
+        moves += i - j;
+        if (moves > max_moves)
+            return false;
+    }
+
+    return true;
+}
+
+// Stable LSD radix sort of 'order' by 'x', 11 bits at a time
+//
+// Each block of points is counted and scattered by its own thread.
+// Blocks are scattered in order, so the sort is stable. Digits that are
+// the same for every key, like the sign and exponent of a short track,
+// are skipped.
+//
+// At most 'threads' threads are used, 0 means use all available threads.
+inline std::vector<size_t> radix_sort (const std::vector<double> &x, const size_t threads = 0)
+{
+    using namespace std;
+
+    const int nthreads = threads == 0 ? omp_get_max_threads () : threads;
+
+    const size_t n = x.size ();
+    const unsigned digit_bits = 11;
+    const size_t radix = size_t (1) << digit_bits;
+    const uint64_t mask = radix - 1;
+    const size_t passes = (64 + digit_bits - 1) / digit_bits;
+    const size_t min_block_size = 1 << 16;
+    const size_t total_blocks = std::max (size_t (1),
+        std::min (size_t (nthreads), n / min_block_size));
+    const size_t block_size = (n + total_blocks - 1) / total_blocks;
+
+    vector<uint64_t> keys (n);
+    vector<size_t> order (n);
+    vector<uint64_t> tmp_keys (n);
+    vector<size_t> tmp_order (n);
+
+    // Count every digit of every key in one pass. The totals tell which
+    // digits are the same for every key.
+    vector<size_t> counts (total_blocks * passes * radix);
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+    for (size_t b = 0; b < total_blocks; ++b)
+    {
+        size_t *c = &counts[b * passes * radix];
+        for (size_t i = b * block_size; i < std::min (n, (b + 1) * block_size); ++i)
+        {
+            keys[i] = get_radix_key (x[i]);
+            order[i] = i;
+            for (size_t pass = 0; pass < passes; ++pass)
+                ++c[pass * radix + ((keys[i] >> (digit_bits * pass)) & mask)];
+        }
+    }
+
+    vector<size_t> offsets (total_blocks * radix);
+    bool scattered = false;
+    for (size_t pass = 0; pass < passes; ++pass)
+    {
+        // Skip the pass if every key has the same digit. Scattering
+        // moves keys between blocks, but it doesn't change how many
+        // keys have each digit.
+        bool trivial = false;
+        for (size_t d = 0; d < radix && !trivial; ++d)
+        {
+            size_t total = 0;
+            for (size_t b = 0; b < total_blocks; ++b)
+                total += counts[(b * passes + pass) * radix + d];
+            trivial = (total == n);
+        }
+        if (trivial)
+            continue;
+
+        // Once the keys have been scattered, each block holds different
+        // keys than the ones it counted, so count this digit again
+        const unsigned shift = digit_bits * pass;
+        if (scattered && total_blocks > 1)
+        {
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+            for (size_t b = 0; b < total_blocks; ++b)
+            {
+                size_t *c = &counts[(b * passes + pass) * radix];
+                std::fill (c, c + radix, 0);
+                for (size_t i = b * block_size; i < std::min (n, (b + 1) * block_size); ++i)
+                    ++c[(keys[i] >> shift) & mask];
+            }
+        }
+
+        // Get where each block's points go for each digit
+        size_t offset = 0;
+        for (size_t d = 0; d < radix; ++d)
+        {
+            for (size_t b = 0; b < total_blocks; ++b)
+            {
+                offsets[b * radix + d] = offset;
+                offset += counts[(b * passes + pass) * radix + d];
+            }
+        }
+        assert (offset == n);
+
+        // Scatter
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+        for (size_t b = 0; b < total_blocks; ++b)
+        {
+            size_t *o = &offsets[b * radix];
+            for (size_t i = b * block_size; i < std::min (n, (b + 1) * block_size); ++i)
+            {
+                const size_t j = o[(keys[i] >> shift) & mask]++;
+                tmp_keys[j] = keys[i];
+                tmp_order[j] = order[i];
+            }
+        }
+
+        swap (keys, tmp_keys);
+        swap (order, tmp_order);
+        scattered = true;
+    }
+
+    return order;
+}
+
+} // namespace detail
+
+// Get the order that sorts the values returned by 'get_x (i)', for 'i'
+// in [0, n)
+//
+// Returns an empty order if they are already sorted.
+template<typename F>
+std::vector<size_t> get_order (const size_t n,
+    const F &get_x,
+    const ordering_params &params = ordering_params ())
+{
+    using namespace std;
+
+    // Copy the keys and check whether they are sorted
+    vector<double> x (n);
+    bool sorted = true;
+    for (size_t i = 0; i < n; ++i)
+    {
+        x[i] = get_x (i);
+        if (i != 0 && x[i] < x[i - 1])
+            sorted = false;
+    }
+
+    // The usual case
+    if (sorted)
+        return vector<size_t> ();
+
+    // Locally out of order
+    //
+    // The insertion sort's moves are bounded, so if the points are far
+    // out of order, not much time is lost finding out.
+    {
+        vector<size_t> order (n);
+        iota (order.begin (), order.end (), 0);
+        auto y (x);
+        if (detail::insertion_sort (y, order, n * params.insertion_sort_moves_per_point))
+            return order;
+    }
+
+    return detail::radix_sort (x, params.threads);
+}
+
+// Get the order that sorts the points in 'p' by X
+//
+// Returns an empty order if they are already sorted.
+template<typename T>
+std::vector<size_t> get_x_order (const T &p, const ordering_params &params = ordering_params ())
+{
+    return get_order (p.size (), [&] (const size_t i) { return p[i].x; }, params);
+}
+
+// Move p[order[i]] to p[i], in place
+//
+// Each cycle of the permutation is followed with one temporary point.
+template<typename T>
+void gather_in_place (T &p, const std::vector<size_t> &order)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (order.size () == p.size ());
+
+    vector<bool> done (order.size ());
+    for (size_t i = 0; i < order.size (); ++i)
+    {
+        if (done[i])
+            continue;
+
+        const typename T::value_type tmp (p[i]);
+        size_t j = i;
+        while (order[j] != i)
+        {
+            p[j] = p[order[j]];
+            done[j] = true;
+            j = order[j];
+        }
+        p[j] = tmp;
+        done[j] = true;
+    }
+}
+
+// Move p[i] to p[order[i]], in place
+//
+// This undoes gather_in_place ().
+template<typename T>
+void scatter_in_place (T &p, const std::vector<size_t> &order)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (order.size () == p.size ());
+
+    vector<bool> done (order.size ());
+    for (size_t i = 0; i < order.size (); ++i)
+    {
+        if (done[i])
+            continue;
+
+        typename T::value_type tmp (p[i]);
+        for (size_t j = order[i]; j != i; j = order[j])
+        {
+            const typename T::value_type next (p[j]);
+            p[j] = tmp;
+            tmp = next;
+            done[j] = true;
+        }
+        p[i] = tmp;
+        done[i] = true;
+    }
+}
+
+} // namespace ordering
+
+} // namespace ATL24_coastnet
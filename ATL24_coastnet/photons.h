@@ -0,0 +1,278 @@
+#pragma once
+
+#include "precompiled.h"
+#include "utils.h"
+
+namespace ATL24_coastnet
+{
+
+// Struct-of-arrays photon container
+//
+// Each field of 'classified_point2d' is stored in its own column, so a
+// stage that only looks at, for example, 'x' and 'prediction' only
+// streams through those two columns.
+//
+// The container can be used in place of a
+// 'std::vector<classified_point2d>' by the templated algorithms:
+// 'p[i].x' returns a proxy whose members are references into the
+// columns, and the iterators return the same proxies, so the
+// algorithms in <algorithm>, including std::sort (), also work. The
+// columns are public, so a stage can also work on them directly.
+//
+// 'Z' is the type of the elevations, and 'C' is the type of the class
+// and prediction labels.
+template<typename Z, typename C>
+class photon_columns
+{
+    public:
+    using value_type = classified_point2d;
+
+    std::vector<size_t> h5_index;
+    std::vector<double> x;
+    std::vector<Z> z;
+    std::vector<C> cls;
+    std::vector<C> prediction;
+    std::vector<Z> surface_elevation;
+    std::vector<Z> bathy_elevation;
+
+    // A reference to one photon
+    template<bool is_const>
+    class basic_reference
+    {
+        template<typename V>
+        using ref = std::conditional_t<is_const, const V, V> &;
+
+        public:
+        ref<size_t> h5_index;
+        ref<double> x;
+        ref<Z> z;
+        ref<C> cls;
+        ref<C> prediction;
+        ref<Z> surface_elevation;
+        ref<Z> bathy_elevation;
+
+        basic_reference (std::conditional_t<is_const, const photon_columns, photon_columns> &p, const size_t i)
+            : h5_index (p.h5_index[i])
+            , x (p.x[i])
+            , z (p.z[i])
+            , cls (p.cls[i])
+            , prediction (p.prediction[i])
+            , surface_elevation (p.surface_elevation[i])
+            , bathy_elevation (p.bathy_elevation[i])
+        {
+        }
+        basic_reference (const basic_reference &) = default;
+        operator classified_point2d () const
+        {
+            return classified_point2d { h5_index, x, z, cls, prediction, surface_elevation, bathy_elevation };
+        }
+        // Assignment copies the photon, not the reference
+        basic_reference &operator= (const classified_point2d &q) requires (!is_const)
+        {
+            // Labels must fit in the label type
+            assert (q.cls == size_t (C (q.cls)));
+            assert (q.prediction == size_t (C (q.prediction)));
+
+            h5_index = q.h5_index;
+            x = q.x;
+            z = q.z;
+            cls = q.cls;
+            prediction = q.prediction;
+            surface_elevation = q.surface_elevation;
+            bathy_elevation = q.bathy_elevation;
+            return *this;
+        }
+        basic_reference &operator= (const basic_reference &q) requires (!is_const)
+        {
+            return *this = classified_point2d (q);
+        }
+        friend void swap (basic_reference a, basic_reference b) requires (!is_const)
+        {
+            const classified_point2d tmp (a);
+            a = b;
+            b = tmp;
+        }
+    };
+    using reference = basic_reference<false>;
+    using const_reference = basic_reference<true>;
+
+    // Random access iterator over photon references
+    template<bool is_const>
+    class basic_iterator
+    {
+        using container = std::conditional_t<is_const, const photon_columns, photon_columns>;
+
+        public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = classified_point2d;
+        using difference_type = std::ptrdiff_t;
+        using reference = basic_reference<is_const>;
+        // 'it->x' needs something that acts like a pointer
+        struct pointer
+        {
+            reference r;
+            reference *operator-> () { return &r; }
+        };
+
+        basic_iterator () : p (nullptr), i (0) { }
+        basic_iterator (container *init_p, const size_t init_i) : p (init_p), i (init_i) { }
+        // Allow iterator to const_iterator conversion
+        operator basic_iterator<true> () const requires (!is_const) { return basic_iterator<true> (p, i); }
+
+        reference operator* () const { return reference (*p, i); }
+        pointer operator-> () const { return pointer { reference (*p, i) }; }
+        reference operator[] (const difference_type n) const { return reference (*p, i + n); }
+
+        basic_iterator &operator++ () { ++i; return *this; }
+        basic_iterator &operator-- () { --i; return *this; }
+        basic_iterator operator++ (int) { auto tmp (*this); ++i; return tmp; }
+        basic_iterator operator-- (int) { auto tmp (*this); --i; return tmp; }
+        basic_iterator &operator+= (const difference_type n) { i += n; return *this; }
+        basic_iterator &operator-= (const difference_type n) { i -= n; return *this; }
+        basic_iterator operator+ (const difference_type n) const { return basic_iterator (p, i + n); }
+        basic_iterator operator- (const difference_type n) const { return basic_iterator (p, i - n); }
+        friend basic_iterator operator+ (const difference_type n, const basic_iterator &it) { return it + n; }
+        difference_type operator- (const basic_iterator &b) const { return difference_type (i) - difference_type (b.i); }
+
+        bool operator== (const basic_iterator &b) const { return i == b.i; }
+        auto operator<=> (const basic_iterator &b) const { return i <=> b.i; }
+
+        private:
+        container *p;
+        size_t i;
+    };
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    photon_columns () = default;
+    explicit photon_columns (const size_t n)
+    {
+        resize (n);
+    }
+    explicit photon_columns (const std::vector<classified_point2d> &p)
+    {
+        reserve (p.size ());
+        for (const auto &q : p)
+            push_back (q);
+    }
+    std::vector<classified_point2d> to_points () const
+    {
+        std::vector<classified_point2d> p (size ());
+        for (size_t i = 0; i < p.size (); ++i)
+            p[i] = (*this)[i];
+        return p;
+    }
+
+    size_t size () const { return x.size (); }
+    bool empty () const { return x.empty (); }
+    void reserve (const size_t n)
+    {
+        h5_index.reserve (n);
+        x.reserve (n);
+        z.reserve (n);
+        cls.reserve (n);
+        prediction.reserve (n);
+        surface_elevation.reserve (n);
+        bathy_elevation.reserve (n);
+    }
+    void resize (const size_t n)
+    {
+        h5_index.resize (n);
+        x.resize (n);
+        z.resize (n);
+        cls.resize (n);
+        prediction.resize (n);
+        surface_elevation.resize (n);
+        bathy_elevation.resize (n);
+    }
+    void clear ()
+    {
+        resize (0);
+    }
+    void push_back (const classified_point2d &q)
+    {
+        resize (size () + 1);
+        back () = q;
+    }
+
+    reference operator[] (const size_t i)
+    {
+        assert (i < size ());
+        return reference (*this, i);
+    }
+    const_reference operator[] (const size_t i) const
+    {
+        assert (i < size ());
+        return const_reference (*this, i);
+    }
+    reference front () { return (*this)[0]; }
+    const_reference front () const { return (*this)[0]; }
+    reference back () { return (*this)[size () - 1]; }
+    const_reference back () const { return (*this)[size () - 1]; }
+
+    iterator begin () { return iterator (this, 0); }
+    iterator end () { return iterator (this, size ()); }
+    const_iterator begin () const { return const_iterator (this, 0); }
+    const_iterator end () const { return const_iterator (this, size ()); }
+
+    bool operator== (const photon_columns &) const = default;
+};
+
+// Full precision, the same as 'classified_point2d'
+using photons = photon_columns<double, size_t>;
+
+// Compact photons
+//
+// Elevations are stored as floats, and the ASPRS labels as bytes. The
+// along-track distance stays in double precision, because a float can't
+// resolve centimeters thousands of kilometers along the track.
+using compact_photons = photon_columns<float, uint8_t>;
+
+// Write photons as a columnar table
+//
+// The double precision columns are written in place, and only the
+// integer columns are converted.
+inline void write_classified_point2d_columnar (std::ostream &os, const photons &p)
+{
+    columnar::writer w (p.size ());
+    w.add_column<int64_t> (PI_NAME, [&] (const size_t i) { return p.h5_index[i]; });
+    w.add_column (X_NAME, p.x);
+    w.add_column (Z_NAME, p.z);
+    w.add_column<int32_t> (LABEL_NAME, [&] (const size_t i) { return p.cls[i]; });
+    w.add_column<int32_t> (PREDICTION_NAME, [&] (const size_t i) { return p.prediction[i]; });
+    w.add_column (SEA_SURFACE_NAME, p.surface_elevation);
+    w.add_column (BATHY_NAME, p.bathy_elevation);
+    w.write (os);
+}
+
+// Copy the points in a dataframe or a columnar table into photons
+//
+// This gives the same photons as convert_dataframe (), but each column
+// is copied straight into its photon column, without building a vector
+// of points first. At most 'threads' threads are used, 0 means use all
+// available threads.
+template<typename T>
+photons convert_dataframe_to_photons (const T &df,
+    bool &has_manual_label,
+    bool &has_predictions,
+    const size_t threads = 0)
+{
+    const auto c = detail::get_dataframe_columns (df);
+
+    has_manual_label = c.cls.has_value ();
+    has_predictions = c.prediction.has_value ();
+
+    photons p (df.rows ());
+
+    detail::copy_column (df, c.h5_index, threads, [&] (const size_t i, const auto v) { p.h5_index[i] = v; });
+    detail::copy_column (df, c.x, threads, [&] (const size_t i, const auto v) { p.x[i] = v; });
+    detail::copy_column (df, c.z, threads, [&] (const size_t i, const auto v) { p.z[i] = v; });
+    detail::copy_column (df, c.cls, threads, [&] (const size_t i, const auto v) { p.cls[i] = v; });
+    detail::copy_column (df, c.prediction, threads, [&] (const size_t i, const auto v) { p.prediction[i] = v; });
+    detail::copy_column (df, c.surface_elevation, threads, [&] (const size_t i, const auto v) { p.surface_elevation[i] = v; });
+    detail::copy_column (df, c.bathy_elevation, threads, [&] (const size_t i, const auto v) { p.bathy_elevation[i] = v; });
+
+    return p;
+}
+
+} // namespace ATL24_coastnet
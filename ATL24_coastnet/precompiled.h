@@ -1,7 +1,13 @@
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <cassert>
+#include <charconv>
 #include <chrono>
 #include <cmath>
+#include <concepts>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <functional>
@@ -10,10 +16,23 @@
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <omp.h>
+#include <optional>
 #include <random>
 #include <set>
+#include <span>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
 #include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 #include <xgboost/c_api.h>
@@ -0,0 +1,487 @@
+#pragma once
+
+#include "precompiled.h"
+#include "json.h"
+#include "tree_ensemble.h"
+#include "xgboost.h"
+
+namespace ATL24_coastnet
+{
+
+namespace xgboost
+{
+
+// Bitmask (QuickScorer style) inference engine for saved XGBoost models
+//
+// See: Lucchese et al., "QuickScorer: a Fast Algorithm to Rank
+// Documents with Additive Ensembles of Regression Trees", SIGIR 2015.
+//
+// Each tree's leaves are numbered from left to right, and each split
+// gets a bitmask with the leaves of its left subtree cleared. When a
+// split's test is false, the row goes right, so those leaves are ruled
+// out. AND together the masks of all the false splits, and the lowest
+// set bit is the leaf that the row ends up in.
+//
+// Feature 0 is the photon elevation, and the rest of the features are
+// raster cells that only ever hold 0, 1 or 2:
+//
+//     - The masks of the raster splits that are false for a value of
+//       0 are folded into one base mask per tree.
+//     - For each raster cell and each value of 1 or 2, the masks of
+//       the splits that are false for that value, but not for 0, are
+//       folded into one correction per tree.
+//     - The elevation splits of each tree are sorted by threshold, and
+//       the prefix ANDs of their masks are stored, so the elevation
+//       only takes one binary search per tree.
+//
+// Nearly all raster cells are empty, so scoring a patch mostly costs a
+// handful of ANDs for each occupied cell.
+class quickscorer
+{
+    public:
+    explicit quickscorer (const bool init_verbose)
+        : verbose (init_verbose)
+        , num_classes (0)
+        , num_features (0)
+        , words (0)
+    {
+    }
+    void load_model (const std::string &filename)
+    {
+        using namespace std;
+
+        if (verbose)
+            clog << "Loading model from " << filename << endl;
+
+        load_model (json::read (filename));
+    }
+    void load_model (const json::value &model)
+    {
+        using namespace std;
+
+        const auto &learner = model["learner"];
+        const auto &gradient_booster = learner["gradient_booster"];
+
+        if (gradient_booster["name"].as_string () != "gbtree")
+            throw runtime_error ("Only gbtree models are supported, not " + gradient_booster["name"].as_string ());
+
+        // Get model parameters
+        const auto &model_param = learner["learner_model_param"];
+        num_classes = std::max (size_t (1), size_t (model_param["num_class"].as_number ()));
+        num_features = model_param["num_feature"].as_number ();
+        base_score = detail::read_base_score (model_param["base_score"], num_classes);
+        elevation_splits = xgboost::get_elevation_splits (model);
+
+        if (num_classes > max_classes)
+            throw runtime_error ("Too many classes");
+
+        const auto &trees = gradient_booster["model"]["trees"];
+        const auto &tree_info = gradient_booster["model"]["tree_info"];
+
+        if (trees.size () != tree_info.size ())
+            throw runtime_error ("The model's tree info does not match its trees");
+
+        // Get the number of mask words needed for the largest tree
+        size_t max_leaves = 1;
+        for (size_t i = 0; i < trees.size (); ++i)
+        {
+            const auto &left_children = trees[i]["left_children"];
+            size_t leaves = 0;
+            for (size_t j = 0; j < left_children.size (); ++j)
+                leaves += left_children[j].as_number () == -1;
+            max_leaves = std::max (max_leaves, leaves);
+        }
+        words = (max_leaves + 63) / 64;
+
+        tree_classes.resize (trees.size ());
+        leaf_values.assign (trees.size () * leaves_per_tree (), 0.0f);
+        base_masks.assign (trees.size () * words, ~mask_word (0));
+        missing_masks.assign (trees.size () * words, ~mask_word (0));
+        elevation_offsets.assign (1, 0);
+        elevation_thresholds.clear ();
+        elevation_masks.clear ();
+
+        // Corrections for each (feature, value) pair, in tree order
+        vector<vector<pair<uint32_t,vector<mask_word>>>> corrections (num_features * 2);
+
+        for (size_t i = 0; i < trees.size (); ++i)
+        {
+            const size_t c = tree_info[i].as_number ();
+            if (c >= num_classes)
+                throw runtime_error ("Tree class is out of range");
+            tree_classes[i] = c;
+            add_tree (trees[i], i, corrections);
+        }
+
+        // Flatten the corrections
+        correction_offsets.assign (1, 0);
+        correction_trees.clear ();
+        correction_masks.clear ();
+        for (const auto &c : corrections)
+        {
+            for (const auto &e : c)
+            {
+                correction_trees.push_back (e.first);
+                correction_masks.insert (correction_masks.end (), e.second.begin (), e.second.end ());
+            }
+            correction_offsets.push_back (correction_trees.size ());
+        }
+
+        if (verbose)
+            clog << "Loaded " << trees.size () << " trees with "
+                << num_classes << " classes, "
+                << words * 64 << " bit leaf masks, "
+                << elevation_thresholds.size () << " elevation splits, and "
+                << correction_trees.size () << " raster corrections" << endl;
+    }
+    // Predict using a row-major 'rows' x 'cols' matrix of features
+    //
+    // It is safe to call this function from more than one thread at a
+    // time.
+    std::vector<uint32_t> predict (const float *features,
+        const size_t rows,
+        const size_t cols) const
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (features != nullptr);
+        assert (rows != 0);
+        assert (!base_score.empty ());
+
+        if (cols < num_features)
+            throw runtime_error ("Not enough features for the model");
+
+        vector<uint32_t> predictions (rows);
+        vector<mask_word> masks (trees () * words);
+
+        for (size_t i = 0; i < rows; ++i)
+        {
+            const float *row = features + i * cols;
+
+            init_masks (row[0], masks);
+
+            // Apply the occupied raster cells
+            for (size_t f = 1; f < num_features; ++f)
+                apply_correction (f, row[f], masks);
+
+            predictions[i] = get_prediction (masks);
+        }
+
+        return predictions;
+    }
+    std::vector<uint32_t> predict (const std::vector<float> &features,
+        const size_t rows,
+        const size_t cols) const
+    {
+        // Check invariants
+        assert (!features.empty ());
+        assert (features.size () == rows * cols);
+
+        return predict (&features[0], rows, cols);
+    }
+    // Predict using sparse features
+    //
+    // Features that are not stored are 0, so only the stored raster
+    // cells need to be visited.
+    std::vector<uint32_t> predict (const sparse_features &features,
+        const size_t cols) const
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (features.rows () != 0);
+        assert (features.indptr.back () == features.values.size ());
+        assert (features.indices.size () == features.values.size ());
+
+        if (cols < num_features)
+            throw runtime_error ("Not enough features for the model");
+
+        const size_t rows = features.rows ();
+        vector<uint32_t> predictions (rows);
+        vector<mask_word> masks (trees () * words);
+
+        for (size_t i = 0; i < rows; ++i)
+        {
+            const size_t begin = features.indptr[i];
+            const size_t end = features.indptr[i + 1];
+
+            // Get the elevation
+            float z = 0.0f;
+            for (size_t j = begin; j < end; ++j)
+                if (features.indices[j] == 0)
+                    z = features.values[j];
+
+            init_masks (z, masks);
+
+            // Apply the stored raster cells
+            for (size_t j = begin; j < end; ++j)
+            {
+                const size_t f = features.indices[j];
+                if (f != 0 && f < num_features)
+                    apply_correction (f, features.values[j], masks);
+            }
+
+            predictions[i] = get_prediction (masks);
+        }
+
+        return predictions;
+    }
+    // Missing sparse features are always treated as 0
+    bool is_sparse () const
+    {
+        return true;
+    }
+    std::vector<float> get_elevation_splits () const
+    {
+        return elevation_splits;
+    }
+    size_t classes () const
+    {
+        return num_classes;
+    }
+    size_t trees () const
+    {
+        return tree_classes.size ();
+    }
+
+    private:
+    using mask_word = uint64_t;
+    static constexpr size_t max_classes = 64;
+
+    const bool verbose;
+    size_t num_classes;
+    size_t num_features;
+    // Number of mask words per tree
+    size_t words;
+    std::vector<float> base_score;
+    std::vector<float> elevation_splits;
+    std::vector<uint32_t> tree_classes;
+    // Leaf values, 'leaves_per_tree ()' per tree
+    std::vector<float> leaf_values;
+    // Masks of the raster splits that are false for 0, 'words' per tree
+    std::vector<mask_word> base_masks;
+    // Masks of the elevation splits that are false for a missing value
+    std::vector<mask_word> missing_masks;
+    // Elevation splits of tree 't' are [elevation_offsets[t],
+    // elevation_offsets[t + 1]), sorted by threshold. Tree 't' has one
+    // more prefix mask than it has splits, starting at
+    // 'elevation_offsets[t] + t'.
+    std::vector<size_t> elevation_offsets;
+    std::vector<float> elevation_thresholds;
+    std::vector<mask_word> elevation_masks;
+    // Corrections for feature 'f' and value 'v' are
+    // [correction_offsets[k], correction_offsets[k + 1]), where
+    // k = 2 * f + v - 1
+    std::vector<size_t> correction_offsets;
+    std::vector<uint32_t> correction_trees;
+    std::vector<mask_word> correction_masks;
+
+    size_t leaves_per_tree () const
+    {
+        return words * 64;
+    }
+    // Start each tree's mask from its base mask and its elevation splits
+    void init_masks (const float z, std::vector<mask_word> &masks) const
+    {
+        using namespace std;
+
+        const bool missing = std::isnan (z) || z == constants::missing_data;
+
+        for (size_t t = 0; t < trees (); ++t)
+        {
+            const mask_word *e;
+            if (missing)
+            {
+                e = &missing_masks[t * words];
+            }
+            else
+            {
+                // Splits with a threshold <= z are false
+                const float *first = elevation_thresholds.data () + elevation_offsets[t];
+                const float *last = elevation_thresholds.data () + elevation_offsets[t + 1];
+                const size_t k = upper_bound (first, last, z) - first;
+                e = &elevation_masks[(elevation_offsets[t] + t + k) * words];
+            }
+
+            const mask_word *b = &base_masks[t * words];
+            mask_word *m = &masks[t * words];
+            for (size_t w = 0; w < words; ++w)
+                m[w] = b[w] & e[w];
+        }
+    }
+    // Apply the corrections for raster feature 'f' holding 'x'
+    void apply_correction (const size_t f, const float x, std::vector<mask_word> &masks) const
+    {
+        using namespace std;
+
+        if (x == 0.0f)
+            return;
+        if (x != 1.0f && x != 2.0f)
+            throw runtime_error ("Raster features must be 0, 1 or 2");
+
+        const size_t k = 2 * f + (x == 1.0f ? 0 : 1);
+        for (size_t j = correction_offsets[k]; j < correction_offsets[k + 1]; ++j)
+        {
+            const mask_word *c = &correction_masks[j * words];
+            mask_word *m = &masks[correction_trees[j] * words];
+            for (size_t w = 0; w < words; ++w)
+                m[w] &= c[w];
+        }
+    }
+    // Find each tree's exit leaf and add up the margins
+    uint32_t get_prediction (const std::vector<mask_word> &masks) const
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (num_classes <= max_classes);
+
+        array<float, max_classes> margins;
+        copy (base_score.begin (), base_score.end (), margins.begin ());
+
+        // Accumulate in tree order, like libxgboost
+        for (size_t t = 0; t < trees (); ++t)
+        {
+            const mask_word *m = &masks[t * words];
+            size_t w = 0;
+            while (m[w] == 0)
+                ++w;
+            assert (w < words);
+            const size_t leaf = w * 64 + countr_zero (m[w]);
+            margins[tree_classes[t]] += leaf_values[t * leaves_per_tree () + leaf];
+        }
+
+        // The prediction is the first class with the largest margin
+        return max_element (margins.begin (), margins.begin () + num_classes) - margins.begin ();
+    }
+    // Add the masks for tree 'tree', which is number 'index'
+    void add_tree (const json::value &tree,
+        const size_t index,
+        std::vector<std::vector<std::pair<uint32_t,std::vector<mask_word>>>> &corrections)
+    {
+        using namespace std;
+
+        detail::check_numerical_splits (tree);
+
+        const auto &left_children = tree["left_children"];
+        const auto &indexes = tree["split_indices"];
+        const auto &conditions = tree["split_conditions"];
+        const auto &lefts = tree["default_left"];
+
+        // Number the leaves from left to right, and get the range of
+        // leaves under each node
+        const size_t nodes = left_children.size ();
+        vector<size_t> first_leaf (nodes);
+        vector<size_t> last_leaf (nodes);
+        size_t leaves = 0;
+        number_leaves (tree, 0, leaves, first_leaf, last_leaf);
+
+        // The elevation splits, and the raster corrections for values 1 and 2
+        vector<pair<float,vector<mask_word>>> splits;
+        map<size_t,pair<vector<mask_word>,vector<mask_word>>> tree_corrections;
+
+        const vector<mask_word> ones (words, ~mask_word (0));
+        auto and_mask = [&] (vector<mask_word> &m, const vector<mask_word> &n)
+        {
+            for (size_t w = 0; w < words; ++w)
+                m[w] &= n[w];
+        };
+
+        for (size_t i = 0; i < nodes; ++i)
+        {
+            const int left = left_children[i].as_number ();
+
+            if (left == -1)
+            {
+                // Leaves store their value in the split condition
+                leaf_values[index * leaves_per_tree () + first_leaf[i]] = conditions[i].as_float ();
+                continue;
+            }
+
+            // Rule out the left subtree
+            vector<mask_word> mask (ones);
+            for (size_t j = first_leaf[left]; j < last_leaf[left]; ++j)
+                mask[j / 64] &= ~(mask_word (1) << (j % 64));
+
+            const size_t f = indexes[i].as_number ();
+            const float t = conditions[i].as_float ();
+            if (f >= num_features)
+                throw runtime_error ("Split index is out of range");
+
+            if (f == 0)
+            {
+                splits.push_back ({ t, mask });
+
+                // Missing values take the default branch
+                if (!lefts[i].as_boolean ())
+                    for (size_t w = 0; w < words; ++w)
+                        missing_masks[index * words + w] &= mask[w];
+                continue;
+            }
+
+            // XGBoost goes right when the value is >= the split condition
+            if (t <= 0.0f)
+            {
+                for (size_t w = 0; w < words; ++w)
+                    base_masks[index * words + w] &= mask[w];
+                continue;
+            }
+
+            auto &c = tree_corrections.try_emplace (f, ones, ones).first->second;
+            if (t <= 1.0f)
+                and_mask (c.first, mask);
+            if (t <= 2.0f)
+                and_mask (c.second, mask);
+        }
+
+        // Sort the elevation splits and get their prefix masks
+        sort (splits.begin (), splits.end (),
+            [] (const auto &a, const auto &b) { return a.first < b.first; });
+
+        vector<mask_word> prefix (ones);
+        elevation_masks.insert (elevation_masks.end (), prefix.begin (), prefix.end ());
+        for (const auto &s : splits)
+        {
+            and_mask (prefix, s.second);
+            elevation_thresholds.push_back (s.first);
+            elevation_masks.insert (elevation_masks.end (), prefix.begin (), prefix.end ());
+        }
+        elevation_offsets.push_back (elevation_thresholds.size ());
+
+        // Save the corrections that rule out any leaves
+        for (const auto &[f, c] : tree_corrections)
+        {
+            if (c.first != ones)
+                corrections[2 * f].push_back ({ index, c.first });
+            if (c.second != ones)
+                corrections[2 * f + 1].push_back ({ index, c.second });
+        }
+    }
+    // Number the leaves under 'node' from left to right
+    static void number_leaves (const json::value &tree,
+        const size_t node,
+        size_t &leaves,
+        std::vector<size_t> &first_leaf,
+        std::vector<size_t> &last_leaf)
+    {
+        first_leaf[node] = leaves;
+
+        const int left = tree["left_children"][node].as_number ();
+        if (left == -1)
+            ++leaves;
+        else
+        {
+            const int right = tree["right_children"][node].as_number ();
+            number_leaves (tree, left, leaves, first_leaf, last_leaf);
+            number_leaves (tree, right, leaves, first_leaf, last_leaf);
+        }
+
+        last_leaf[node] = leaves;
+    }
+
+};
+
+} // namespace xgboost
+
+} // namespace ATL24_coastnet
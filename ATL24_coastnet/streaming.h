@@ -0,0 +1,430 @@
+#pragma once
+
+#include "precompiled.h"
+#include "coastnet.h"
+#include "columnar.h"
+#include "photons.h"
+
+namespace ATL24_coastnet
+{
+
+// Classify a granule in along-track chunks
+//
+// The points must be sorted by X. They are read from a source one chunk
+// at a time, and each classified chunk is handed to a writer as soon as
+// it's done, so only one chunk of photons, including its halo, is in
+// memory at a time.
+//
+// The results are identical to classifying the whole granule at once.
+// Each photon's prediction only depends on the photons within half a
+// patch width of it, and the isolated bathy filter only depends on the
+// photons within twice its radius, so those are covered by halos around
+// each chunk. The elevation estimates and the blunder detection
+// statistics depend on the whole granule, so the granule is read twice:
+//
+//     1. Predict each chunk, and accumulate the 1m elevation bins, the
+//        sea surface variance bins, and the surface and bathy counts.
+//        Keep one byte per photon for its prediction.
+//     2. Smooth the elevation bins for the whole granule. Then set the
+//        estimates for each chunk and run the blunder detection on it.
+//
+// The bins take memory in proportion to the length of the track, not
+// the number of photons.
+namespace streaming
+{
+
+struct stream_params
+{
+    // Photons per chunk, counting the halos
+    //
+    // A chunk always gets at least one photon of its own, so a chunk
+    // whose halo alone is larger than this will go over.
+    size_t chunk_size = 1 << 20;
+};
+
+// Get the number of photons per chunk, including the halo, that fit in
+// 'bytes'
+//
+// Some of the memory does not depend on the chunk size, so it is taken
+// out of the budget first: one byte per photon in the granule for its
+// prediction, each thread's feature buffers, and the prediction cache.
+// The model and the elevation bins are not counted.
+inline size_t get_chunk_size (const size_t bytes, const size_t total_points, const classify_params &cp)
+{
+    using namespace std;
+
+    const size_t threads = cp.threads == 0 ? omp_get_max_threads () : cp.threads;
+
+    // A thread holds at most a batch of dense features, and with a
+    // cache, a copy of the rows that missed it
+    const size_t feature_bytes = ATL24_coastnet::detail::predict_batch_size
+        * FEATURES_PER_SAMPLE * sizeof (float) * (cp.cache ? 2 : 1);
+    const size_t cache_bytes = cp.cache ? cp.cache_entries * patch_cache::bytes_per_entry : 0;
+    const size_t fixed_bytes = total_points * sizeof (uint8_t) + threads * feature_bytes + cache_bytes;
+    if (fixed_bytes >= bytes)
+        throw runtime_error ("The chunk budget is too small, the predictions, feature buffers and cache take "
+            + to_string ((fixed_bytes >> 20) + 1) + "MB");
+
+    // Each photon takes this much in a 'photons' container
+    const size_t photon_bytes = 3 * sizeof (size_t) + 4 * sizeof (double);
+    return std::max (size_t (1), (bytes - fixed_bytes) / photon_bytes);
+}
+
+// A read-only view of photons [begin, end) of a container
+//
+// This is what gets handed to the writer, so a chunk doesn't have to be
+// copied to drop its halo.
+template<typename T>
+class photon_range
+{
+    public:
+    using value_type = typename T::value_type;
+
+    photon_range (const T &init_p, const size_t init_begin, const size_t init_end)
+        : p (init_p)
+        , begin (init_begin)
+        , end (init_end)
+    {
+        assert (begin <= end);
+        assert (end <= p.size ());
+    }
+    size_t size () const
+    {
+        return end - begin;
+    }
+    auto operator[] (const size_t i) const
+    {
+        assert (i < size ());
+        return p[begin + i];
+    }
+
+    private:
+    const T &p;
+    size_t begin;
+    size_t end;
+};
+
+// A source that reads photons from a container of points
+template<typename T>
+class container_source
+{
+    public:
+    explicit container_source (const T &init_p)
+        : p (init_p)
+    {
+    }
+    size_t size () const
+    {
+        return p.size ();
+    }
+    double get_x (const size_t i) const
+    {
+        return p[i].x;
+    }
+    photons get (const size_t begin, const size_t end) const
+    {
+        assert (begin <= end);
+        assert (end <= p.size ());
+        photons q (end - begin);
+        for (size_t i = begin; i < end; ++i)
+            q[i - begin] = classified_point2d (p[i]);
+        return q;
+    }
+
+    private:
+    const T &p;
+};
+
+// A source that reads photons from a columnar table
+//
+// The table is mapped, so only the rows in a chunk are copied.
+class columnar_source
+{
+    public:
+    explicit columnar_source (const columnar::table &init_t)
+        : t (init_t)
+        , pi_col (t.get_column_index (PI_NAME))
+        , x_col (t.get_column_index (X_NAME))
+        , z_col (t.get_column_index (Z_NAME))
+        , cls_col (t.has_column (LABEL_NAME) ? std::optional<size_t> (t.get_column_index (LABEL_NAME)) : std::nullopt)
+    {
+    }
+    size_t size () const
+    {
+        return t.rows ();
+    }
+    double get_x (const size_t i) const
+    {
+        return t.get_value (x_col, i);
+    }
+    photons get (const size_t begin, const size_t end) const
+    {
+        assert (begin <= end);
+        assert (end <= t.rows ());
+        photons q (end - begin);
+        copy_column (pi_col, q.h5_index, begin, end);
+        copy_column (x_col, q.x, begin, end);
+        copy_column (z_col, q.z, begin, end);
+        if (cls_col)
+            copy_column (*cls_col, q.cls, begin, end);
+        return q;
+    }
+
+    private:
+    const columnar::table &t;
+    size_t pi_col;
+    size_t x_col;
+    size_t z_col;
+    std::optional<size_t> cls_col;
+
+    template<typename T>
+    void copy_column (const size_t col, std::vector<T> &v, const size_t begin, const size_t end) const
+    {
+        t.visit_column (col, [&] (const auto values)
+        {
+            std::copy (values.begin () + begin, values.begin () + end, v.begin ());
+        });
+    }
+};
+
+namespace detail
+{
+
+// Get the rows [begin, end) plus the rows within 'halo' meters of them
+template<typename S>
+std::pair<size_t,size_t> get_halo (const S &source,
+    const size_t begin,
+    const size_t end,
+    const double halo)
+{
+    // Check invariants
+    assert (begin < end);
+    assert (end <= source.size ());
+
+    // Binary search for the first point that's close enough on the left
+    const double left_x = source.get_x (begin) - halo;
+    size_t lo = 0;
+    size_t hi = begin;
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (source.get_x (mid) < left_x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    const size_t halo_begin = lo;
+
+    // Binary search for the first point that's too far on the right
+    const double right_x = source.get_x (end - 1) + halo;
+    lo = end;
+    hi = source.size ();
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (source.get_x (mid) > right_x)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    const size_t halo_end = lo;
+
+    return std::make_pair (halo_begin, halo_end);
+}
+
+// Split the rows into chunks that each hold at most 'chunk_size' rows,
+// counting the rows within 'halo' meters of them
+//
+// Returns the first row of each chunk, followed by the number of rows.
+template<typename S>
+std::vector<size_t> get_chunk_bounds (const S &source,
+    const size_t chunk_size,
+    const double halo)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (chunk_size != 0);
+
+    const size_t n = source.size ();
+    vector<size_t> bounds { 0 };
+    while (bounds.back () != n)
+    {
+        const size_t begin = bounds.back ();
+        auto fits = [&] (const size_t end)
+        {
+            const auto [halo_begin, halo_end] = get_halo (source, begin, end, halo);
+            return halo_end - halo_begin <= chunk_size;
+        };
+
+        // The halo only grows as the chunk gets longer, so binary
+        // search for the longest chunk that fits. Every chunk gets at
+        // least one row.
+        size_t lo = begin + 1;
+        size_t hi = std::min (n, begin + chunk_size);
+        while (lo < hi)
+        {
+            const size_t mid = lo + (hi - lo + 1) / 2;
+            if (fits (mid))
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        bounds.push_back (lo);
+    }
+
+    return bounds;
+}
+
+} // namespace detail
+
+// Classify the points in 'source', and call 'write_chunk (q)' with
+// each chunk of classified photons, in order
+//
+// 'q' is a photon_range, and it is only valid during the call.
+//
+// See the description above.
+template<typename S,typename W,typename U>
+void classify (const bool verbose,
+    const S &source,
+    const W &write_chunk,
+    const U &predictor,
+    const classify_params &cp = classify_params (),
+    const stream_params &sp = stream_params ())
+{
+    using namespace std;
+
+    // Check invariants
+    assert (sp.chunk_size != 0);
+
+    // The predictor must be set up for the type of features we use
+    if (cp.sparse && !predictor.is_sparse ())
+        throw runtime_error ("The booster has not been set up for sparse features");
+
+    const size_t n = source.size ();
+    if (n == 0)
+        return;
+
+    const postprocess_params params;
+
+    // A photon's patch reaches half a patch width to either side, and
+    // the isolated bathy filter looks at the neighbors of its neighbors.
+    // The extra meter keeps rounding from moving a photon out of the
+    // halo.
+    const double predict_halo = sampling_params::patch_cols * sampling_params::aspect_ratio / 2.0 + 1.0;
+    const double postprocess_halo = 2.0 * params.isolated_bathy_radius + 1.0;
+
+    // Both passes use the same chunks, so size them for the larger halo
+    const auto bounds = detail::get_chunk_bounds (source, sp.chunk_size, std::max (predict_halo, postprocess_halo));
+    const size_t total_chunks = bounds.size () - 1;
+
+    if (verbose)
+        clog << "Classifying " << n << " points in " << total_chunks << " chunks" << endl;
+
+    // Repeated patches can be served from a cache that all the chunks share
+    optional<patch_cache> cache;
+    if (cp.cache)
+        cache.emplace (predictor.get_elevation_splits (), cp.cache_entries);
+    ATL24_coastnet::detail::cache_stats stats;
+
+    // Pass 1, predict
+    timer t;
+    const unsigned min_x = source.get_x (0);
+    ATL24_coastnet::detail::elevation_bins elevation_bins (min_x);
+    ATL24_coastnet::detail::surface_variance_bins variance_bins (params.blunder_surface_bin_size, min_x);
+    size_t total_bathy = 0;
+    size_t total_surface = 0;
+    vector<uint8_t> predictions (n);
+    double last_x = source.get_x (0);
+
+    for (size_t k = 0; k < total_chunks; ++k)
+    {
+        const size_t begin = bounds[k];
+        const size_t end = bounds[k + 1];
+        const auto [halo_begin, halo_end] = detail::get_halo (source, begin, end, predict_halo);
+
+        // The previous chunk's last point is either in the halo, or it
+        // was 'last_x'
+        auto p = source.get (halo_begin, halo_end);
+        for (size_t i = 0; i < p.size (); ++i)
+        {
+            if (i == 0 ? (halo_begin == begin && p.x[i] < last_x) : p.x[i] < p.x[i - 1])
+                throw runtime_error ("Points must be sorted by " + X_NAME + " to classify them in chunks");
+            p.prediction[i] = 0;
+        }
+
+        ATL24_coastnet::detail::predict_points (false, p, begin - halo_begin, end - halo_begin, predictor, cp, cache, stats);
+
+        // Accumulate the statistics in order along the track, just
+        // like set_elevation_estimates () and blunder_detection ()
+        for (size_t i = begin - halo_begin; i < end - halo_begin; ++i)
+        {
+            assert (p.prediction[i] <= numeric_limits<uint8_t>::max ());
+            predictions[halo_begin + i] = p.prediction[i];
+            elevation_bins.add (p.x[i], p.z[i], p.prediction[i]);
+
+            ATL24_coastnet::detail::check_elevation (p[i], params);
+            if (p.prediction[i] == bathy_class)
+            {
+                ++total_bathy;
+            }
+            else if (p.prediction[i] == sea_surface_class)
+            {
+                ++total_surface;
+                variance_bins.add (p.x[i], p.z[i]);
+            }
+        }
+        last_x = p.x[end - halo_begin - 1];
+
+        if (verbose)
+            clog << "Predicted chunk " << k + 1 << " of " << total_chunks
+                << ", " << end - begin << " points, " << p.size () << " with the halo" << endl;
+    }
+
+    if (verbose)
+    {
+        t.stop ();
+        clog << "Predicted " << n << " points in " << t.elapsed_ms () << "ms" << endl;
+        ATL24_coastnet::detail::print_cache_stats (cache, stats);
+    }
+
+    elevation_bins.smooth (last_x, params.surface_sigma, params.bathy_sigma, cp.threads != 1);
+
+    // If there is no surface, there can't be any bathy
+    const bool no_surface = total_bathy != 0 && total_surface == 0;
+
+    // Pass 2, post-process and write
+    for (size_t k = 0; k < total_chunks; ++k)
+    {
+        const size_t begin = bounds[k];
+        const size_t end = bounds[k + 1];
+        const auto [halo_begin, halo_end] = detail::get_halo (source, begin, end, postprocess_halo);
+
+        auto p = source.get (halo_begin, halo_end);
+        for (size_t i = 0; i < p.size (); ++i)
+        {
+            p.prediction[i] = predictions[halo_begin + i];
+            p.surface_elevation[i] = elevation_bins.get_surface_estimate (p.x[i]);
+            p.bathy_elevation[i] = elevation_bins.get_bathy_estimate (p.x[i]);
+
+            if (no_surface)
+            {
+                p.prediction[i] = 0;
+                continue;
+            }
+
+            ATL24_coastnet::detail::check_elevation (p[i], params);
+            ATL24_coastnet::detail::check_estimates (p[i], variance_bins, params);
+        }
+
+        if (!no_surface)
+            ATL24_coastnet::detail::filter_isolated_bathy_in_place (p, params.isolated_bathy_radius, params.isolated_bathy_min_photons);
+
+        // Drop the halo
+        write_chunk (photon_range (p, begin - halo_begin, end - halo_begin));
+    }
+}
+
+} // namespace streaming
+
+} // namespace ATL24_coastnet
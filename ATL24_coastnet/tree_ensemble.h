@@ -0,0 +1,387 @@
+#pragma once
+
+#include "precompiled.h"
+#include "json.h"
+#include "xgboost.h"
+
+namespace ATL24_coastnet
+{
+
+namespace xgboost
+{
+
+namespace detail
+{
+
+// Get the model's base score for each of its 'n' classes
+inline std::vector<float> read_base_score (const json::value &v, const size_t n)
+{
+    using namespace std;
+
+    // Newer versions of XGBoost write one score per class as a
+    // string that holds an array
+    const string s = v.is_string () ? v.as_string () : string ();
+    if (!s.empty () && s.front () == '[')
+    {
+        const auto a = json::parse (s);
+        if (a.size () != n)
+            throw runtime_error ("The base score does not match the number of classes");
+        vector<float> b (n);
+        for (size_t i = 0; i < n; ++i)
+            b[i] = a[i].as_float ();
+        return b;
+    }
+
+    return vector<float> (n, v.as_float ());
+}
+
+// Categorical splits are not supported
+inline void check_numerical_splits (const json::value &tree)
+{
+    using namespace std;
+
+    if (!tree.contains ("split_type"))
+        return;
+
+    const auto &split_type = tree["split_type"];
+    for (size_t i = 0; i < split_type.size (); ++i)
+        if (split_type[i].as_number () != 0)
+            throw runtime_error ("Categorical splits are not supported");
+}
+
+} // namespace detail
+
+// Built-in inference engine for saved XGBoost tree models
+//
+// The model JSON is parsed into flat node arrays. Every tree is padded
+// out to a perfect binary tree of the model's maximum depth, so each
+// row takes exactly 'depth' steps to reach a leaf, and the branches
+// become index arithmetic:
+//
+//     node = 2 * node + 1 + go_right
+//
+// Padding nodes send both children to copies of the same leaf, so they
+// don't change the result.
+//
+// The trees are grouped by output class, and each class's trees are
+// stored in one contiguous block, struct-of-arrays style. Rows are
+// evaluated in small blocks, one tree at a time, so the inner loops
+// run over independent rows.
+//
+// The margins are accumulated the same way libxgboost does it, in
+// single precision and in tree order, starting from the base score, so
+// the predictions match xgbooster::predict ().
+class tree_ensemble
+{
+    public:
+    explicit tree_ensemble (const bool init_verbose)
+        : verbose (init_verbose)
+        , num_classes (0)
+        , num_features (0)
+        , depth (0)
+    {
+    }
+    void load_model (const std::string &filename)
+    {
+        using namespace std;
+
+        if (verbose)
+            clog << "Loading model from " << filename << endl;
+
+        load_model (json::read (filename));
+    }
+    void load_model (const json::value &model)
+    {
+        using namespace std;
+
+        const auto &learner = model["learner"];
+        const auto &gradient_booster = learner["gradient_booster"];
+
+        if (gradient_booster["name"].as_string () != "gbtree")
+            throw runtime_error ("Only gbtree models are supported, not " + gradient_booster["name"].as_string ());
+
+        // Get model parameters
+        const auto &model_param = learner["learner_model_param"];
+        num_classes = std::max (size_t (1), size_t (model_param["num_class"].as_number ()));
+        num_features = model_param["num_feature"].as_number ();
+        base_score = detail::read_base_score (model_param["base_score"], num_classes);
+        elevation_splits = xgboost::get_elevation_splits (model);
+
+        const auto &trees = gradient_booster["model"]["trees"];
+        const auto &tree_info = gradient_booster["model"]["tree_info"];
+
+        if (trees.size () != tree_info.size ())
+            throw runtime_error ("The model's tree info does not match its trees");
+
+        // Find the padded depth
+        depth = 0;
+        for (size_t i = 0; i < trees.size (); ++i)
+            depth = std::max (depth, get_depth (trees[i]));
+
+        if (depth > max_supported_depth)
+            throw runtime_error ("Tree depth " + to_string (depth) + " is too deep");
+
+        // Group the trees by class, keeping them in order within each class
+        class_offsets.assign (num_classes + 1, 0);
+        for (size_t i = 0; i < tree_info.size (); ++i)
+        {
+            const size_t c = tree_info[i].as_number ();
+            if (c >= num_classes)
+                throw runtime_error ("Tree class is out of range");
+            ++class_offsets[c + 1];
+        }
+        partial_sum (class_offsets.begin (), class_offsets.end (), class_offsets.begin ());
+
+        const size_t internal = internal_nodes ();
+        const size_t leaves = leaf_nodes ();
+        split_indexes.assign (trees.size () * internal, 0);
+        split_conditions.assign (trees.size () * internal, 0.0f);
+        default_left.assign (trees.size () * internal, 1);
+        leaf_values.assign (trees.size () * leaves, 0.0f);
+
+        // Flatten the trees
+        vector<size_t> next (class_offsets.begin (), class_offsets.end () - 1);
+        for (size_t i = 0; i < trees.size (); ++i)
+        {
+            const size_t c = tree_info[i].as_number ();
+            flatten (trees[i], next[c]++);
+        }
+
+        if (verbose)
+            clog << "Loaded " << trees.size () << " trees with "
+                << num_classes << " classes and depth " << depth << endl;
+    }
+    // Predict using a row-major 'rows' x 'cols' matrix of features
+    //
+    // It is safe to call this function from more than one thread at a
+    // time.
+    std::vector<uint32_t> predict (const float *features,
+        const size_t rows,
+        const size_t cols) const
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (features != nullptr);
+        assert (rows != 0);
+        assert (!base_score.empty ());
+
+        if (cols < num_features)
+            throw runtime_error ("Not enough features for the model");
+
+        vector<uint32_t> predictions (rows);
+        vector<float> margins (block_size * num_classes);
+        array<uint32_t, block_size> nodes;
+
+        for (size_t begin = 0; begin < rows; begin += block_size)
+        {
+            const size_t n = std::min (block_size, rows - begin);
+            const float *block = features + begin * cols;
+
+            // Start from the base score
+            for (size_t j = 0; j < n; ++j)
+                for (size_t c = 0; c < num_classes; ++c)
+                    margins[j * num_classes + c] = base_score[c];
+
+            // Add the trees for each class, in order
+            for (size_t c = 0; c < num_classes; ++c)
+            {
+                for (size_t t = class_offsets[c]; t < class_offsets[c + 1]; ++t)
+                {
+                    const uint32_t *indexes = &split_indexes[t * internal_nodes ()];
+                    const float *conditions = &split_conditions[t * internal_nodes ()];
+                    const uint8_t *lefts = &default_left[t * internal_nodes ()];
+                    const float *values = &leaf_values[t * leaf_nodes ()];
+
+                    for (size_t j = 0; j < n; ++j)
+                        nodes[j] = 0;
+
+                    // Take one step down the tree for every row
+                    for (size_t d = 0; d < depth; ++d)
+                    {
+                        for (size_t j = 0; j < n; ++j)
+                        {
+                            const uint32_t k = nodes[j];
+                            const float x = block[j * cols + indexes[k]];
+                            const bool missing = std::isnan (x) || x == constants::missing_data;
+                            const uint32_t right = missing ? !lefts[k] : !(x < conditions[k]);
+                            nodes[j] = 2 * k + 1 + right;
+                        }
+                    }
+
+                    // Add the leaf values
+                    const size_t first_leaf = internal_nodes ();
+                    for (size_t j = 0; j < n; ++j)
+                        margins[j * num_classes + c] += values[nodes[j] - first_leaf];
+                }
+            }
+
+            // The prediction is the first class with the largest margin
+            for (size_t j = 0; j < n; ++j)
+            {
+                const float *m = &margins[j * num_classes];
+                predictions[begin + j] = max_element (m, m + num_classes) - m;
+            }
+        }
+
+        return predictions;
+    }
+    std::vector<uint32_t> predict (const std::vector<float> &features,
+        const size_t rows,
+        const size_t cols) const
+    {
+        // Check invariants
+        assert (!features.empty ());
+        assert (features.size () == rows * cols);
+
+        return predict (&features[0], rows, cols);
+    }
+    // Predict using sparse features
+    //
+    // Features that are not stored are 0.
+    std::vector<uint32_t> predict (const sparse_features &features,
+        const size_t cols) const
+    {
+        // Check invariants
+        assert (features.rows () != 0);
+
+        return predict (to_dense (features, cols), features.rows (), cols);
+    }
+    // Missing sparse features are always treated as 0
+    bool is_sparse () const
+    {
+        return true;
+    }
+    std::vector<float> get_elevation_splits () const
+    {
+        return elevation_splits;
+    }
+    size_t classes () const
+    {
+        return num_classes;
+    }
+    size_t trees () const
+    {
+        return class_offsets.empty () ? 0 : class_offsets.back ();
+    }
+    size_t get_depth () const
+    {
+        return depth;
+    }
+    float get_base_score (const size_t c) const
+    {
+        assert (c < base_score.size ());
+        return base_score[c];
+    }
+
+    private:
+    static constexpr size_t max_supported_depth = 16;
+    static constexpr size_t block_size = 64;
+
+    const bool verbose;
+    size_t num_classes;
+    size_t num_features;
+    size_t depth;
+    std::vector<float> base_score;
+    std::vector<float> elevation_splits;
+    // Trees for class 'c' are [class_offsets[c], class_offsets[c + 1])
+    std::vector<size_t> class_offsets;
+    // Internal nodes, 'internal_nodes ()' per tree
+    std::vector<uint32_t> split_indexes;
+    std::vector<float> split_conditions;
+    std::vector<uint8_t> default_left;
+    // Leaves, 'leaf_nodes ()' per tree
+    std::vector<float> leaf_values;
+
+    size_t internal_nodes () const
+    {
+        return (size_t (1) << depth) - 1;
+    }
+    size_t leaf_nodes () const
+    {
+        return size_t (1) << depth;
+    }
+    static size_t get_depth (const json::value &tree)
+    {
+        using namespace std;
+
+        const auto &left_children = tree["left_children"];
+        const auto &right_children = tree["right_children"];
+
+        // Walk the tree from the root
+        size_t max_depth = 0;
+        vector<pair<size_t,size_t>> stack { { 0, 0 } };
+        while (!stack.empty ())
+        {
+            const auto [node, d] = stack.back ();
+            stack.pop_back ();
+            max_depth = std::max (max_depth, d);
+
+            const int left = left_children[node].as_number ();
+            if (left == -1)
+                continue;
+            const int right = right_children[node].as_number ();
+            stack.push_back ({ left, d + 1 });
+            stack.push_back ({ right, d + 1 });
+        }
+
+        return max_depth;
+    }
+    // Copy tree 'tree' into slot 'slot' of the padded node arrays
+    void flatten (const json::value &tree, const size_t slot)
+    {
+        using namespace std;
+
+        const auto &left_children = tree["left_children"];
+        const auto &right_children = tree["right_children"];
+        const auto &indexes = tree["split_indices"];
+        const auto &conditions = tree["split_conditions"];
+        const auto &lefts = tree["default_left"];
+
+        detail::check_numerical_splits (tree);
+
+        // Each entry is (model node, padded node, depth)
+        vector<tuple<size_t,size_t,size_t>> stack { { 0, 0, 0 } };
+        while (!stack.empty ())
+        {
+            const auto [node, padded, d] = stack.back ();
+            stack.pop_back ();
+
+            const int left = left_children[node].as_number ();
+
+            if (left == -1)
+            {
+                // Leaves store their value in the split condition
+                const float value = conditions[node].as_float ();
+
+                // Copy the leaf into every padded leaf below it
+                const size_t levels = depth - d;
+                const size_t first = ((padded + 1) << levels) - 1 - internal_nodes ();
+                for (size_t i = 0; i < (size_t (1) << levels); ++i)
+                    leaf_values[slot * leaf_nodes () + first + i] = value;
+                continue;
+            }
+
+            // Check invariants
+            assert (d < depth);
+            assert (padded < internal_nodes ());
+
+            const size_t split_index = indexes[node].as_number ();
+            if (split_index >= num_features)
+                throw runtime_error ("Split index is out of range");
+
+            const size_t k = slot * internal_nodes () + padded;
+            split_indexes[k] = split_index;
+            split_conditions[k] = conditions[node].as_float ();
+            default_left[k] = lefts[node].as_boolean ();
+
+            const int right = right_children[node].as_number ();
+            stack.push_back ({ left, 2 * padded + 1, d + 1 });
+            stack.push_back ({ right, 2 * padded + 2, d + 1 });
+        }
+    }
+};
+
+} // namespace xgboost
+
+} // namespace ATL24_coastnet
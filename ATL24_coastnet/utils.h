@@ -1,6 +1,9 @@
 #pragma once
 
+#include "columnar.h"
+#include "csv_writer.h"
 #include "raster.h"
+#include "xgboost.h"
 
 const std::string PI_NAME ("index_ph");
 const std::string X_NAME ("x_atc");
@@ -66,70 +69,130 @@ const std::string LABEL_NAME = std::string ("manual_label");
 const std::string SEA_SURFACE_NAME = std::string ("sea_surface_h");
 const std::string BATHY_NAME = std::string ("bathy_h");
 
-struct photon_hash
-{
-    std::size_t operator() (const std::pair<long,long> &v) const
-    {
-        size_t hash = (v.first << 0) ^ (v.second << 32);
-        return hash;
-    }
-};
-
+// Cache of predictions, keyed by patch
+//
+// In low signal regions many photons produce identical patches, for
+// example an isolated photon in empty air. Each patch is keyed by its
+// raster cells and the bin that its elevation falls into, where the
+// bins are delimited by the model's elevation split thresholds. Two
+// elevations in the same bin take every elevation split the same way,
+// so a patch with the same key always gets the same prediction, and
+// serving it from the cache is exact.
+//
+// The cache is split into shards, each with its own lock, so it can be
+// shared by all of the threads that classify a granule.
+//
+// Keys are fixed size, 'Cells' raster cells packed 4 to a byte, so
+// looking one up does not allocate. The cache holds at most
+// 'init_capacity' entries.
+template<size_t Cells>
 class prediction_cache
 {
     public:
-    template<typename T>
-    bool check (const T &p, const size_t i) const
+    using key_type = std::array<uint8_t, sizeof (uint32_t) + (Cells + 3) / 4>;
+
+    struct key_hash
+    {
+        size_t operator() (const key_type &key) const
+        {
+            const std::string_view s (reinterpret_cast<const char *> (key.data ()), key.size ());
+            return std::hash<std::string_view> () (s);
+        }
+    };
+
+    // Approximate size of an entry, including the hash table overhead
+    static constexpr size_t bytes_per_entry = sizeof (key_type) + sizeof (uint32_t) + 4 * sizeof (void *);
+
+    explicit prediction_cache (const std::vector<float> &init_elevation_splits,
+        const size_t init_capacity = 1 << 16)
+        : elevation_splits (init_elevation_splits)
+        , capacity (init_capacity)
+        , shards (total_shards)
     {
-        // Get photon coordinate
-        const auto h = photon_coord (p, i);
+        using namespace std;
 
-        // Check the map
-        if (m.find (h) != m.end ())
-            return true;
-        else
-            return false;
+        // The bins must be sorted
+        sort (elevation_splits.begin (), elevation_splits.end ());
     }
-    template<typename T>
-    long get_prediction (const T &p, const size_t i) const
+    // Get the key for a patch
+    //
+    // Raster cells only hold 0, 1 or 2, so they get packed 4 to a byte.
+    key_type get_key (const float z, const float *cells) const
     {
-        // Get photon coordinate
-        const auto h = photon_coord (p, i);
+        using namespace std;
+
+        // Get the elevation bin, missing elevations go in their own bin
+        const uint32_t bin = (std::isnan (z) || z == xgboost::constants::missing_data)
+            ? elevation_splits.size () + 1
+            : upper_bound (elevation_splits.begin (), elevation_splits.end (), z) - elevation_splits.begin ();
+
+        key_type key {};
+        memcpy (&key[0], &bin, sizeof (bin));
+        for (size_t i = 0; i < Cells; ++i)
+        {
+            const unsigned v = cells[i];
 
-        // Check logic
-        assert (m.find (h) != m.end ());
+            // Check invariants
+            assert (v == cells[i]);
+            assert (v < 4);
 
-        // Get the value
-        return m.at (h);
+            key[sizeof (bin) + i / 4] |= v << (2 * (i % 4));
+        }
+        return key;
     }
-    template<typename T>
-    void update (const T &p, const size_t i, const long prediction)
+    // Look up a prediction
+    bool find (const key_type &key, uint32_t &prediction) const
     {
-        // Get photon coordinate
-        const auto h = photon_coord (p, i);
-
-        // Set the value
-        m[h] = prediction;
+        const auto &s = get_shard (key);
+        std::lock_guard<std::mutex> lock (s.mutex);
+        const auto it = s.m.find (key);
+        if (it == s.m.end ())
+            return false;
+        prediction = it->second;
+        return true;
+    }
+    // Save a prediction
+    //
+    // Once the cache is full, new predictions are not saved.
+    void update (const key_type &key, const uint32_t prediction)
+    {
+        auto &s = get_shard (key);
+        std::lock_guard<std::mutex> lock (s.mutex);
+        if (s.m.size () < capacity / total_shards)
+            s.m.emplace (key, prediction);
+    }
+    size_t size () const
+    {
+        size_t n = 0;
+        for (const auto &s : shards)
+        {
+            std::lock_guard<std::mutex> lock (s.mutex);
+            n += s.m.size ();
+        }
+        return n;
     }
 
     private:
-    std::unordered_map<std::pair<long,long>, long, photon_hash> m;
-    const double x_resolution = 0.5;
-    const double z_resolution = 0.5;
+    static constexpr size_t total_shards = 64;
 
-    // Compute a hash from a photon's location
-    template<typename T>
-    std::pair<long,long> photon_coord (const T &p, const size_t i) const
+    struct shard
     {
-        // Check invariants
-        assert (i < p.size ());
+        mutable std::mutex mutex;
+        std::unordered_map<key_type, uint32_t, key_hash> m;
+    };
 
-        // Quantize
-        const long x = std::round (p[i].x / x_resolution);
-        const long z = std::round (p[i].z / z_resolution);
+    std::vector<float> elevation_splits;
+    const size_t capacity;
+    std::vector<shard> shards;
 
-        return std::make_pair (x, z);
-    };
+    shard &get_shard (const key_type &key)
+    {
+        return shards[key_hash () (key) % total_shards];
+    }
+    const shard &get_shard (const key_type &key) const
+    {
+        return shards[key_hash () (key) % total_shards];
+    }
 };
 
 template<typename T>
@@ -137,64 +200,74 @@ void write_point2d (std::ostream &os, const T &p)
 {
     using namespace std;
 
-    // Save precision
-    const auto pr = os.precision ();
-
     // Print along-track meters
-    os << "index_ph,x_atc,geoid_corr_h,manual_label" << endl;
-    for (size_t i = 0; i < p.size (); ++i)
+    os << "index_ph,x_atc,geoid_corr_h,manual_label\n";
+    csv::write_rows (os, p.size (), [&](string &s, const size_t i)
     {
         // Write the index
-        os << fixed;
-        os << p[i].h5_index;
-        os << setprecision (4) << fixed;
-        os << "," << p[i].x;
-        os << setprecision (4) << fixed;;
-        os << "," << p[i].z;
-        os << ",0"; // 0=unlabeled
-        os << endl;
-    }
-
-    // Restore precision
-    os.precision (pr);
+        csv::append_integer (s, p[i].h5_index);
+        s += ',';
+        csv::append_fixed (s, p[i].x, 4);
+        s += ',';
+        csv::append_fixed (s, p[i].z, 4);
+        s += ",0\n"; // 0=unlabeled
+    });
 }
 
+// Leave out the header to append more points to a file
+//
+// At most 'threads' threads are used, 0 means use all available threads.
 template<typename T>
-void write_classified_point2d (std::ostream &os, const T &p)
+void write_classified_point2d (std::ostream &os, const T &p, const bool header = true, const size_t threads = 0)
 {
     using namespace std;
 
-    // Save precision
-    const auto pr = os.precision ();
-
     // Print along-track meters
-    os << "index_ph,x_atc,geoid_corr_h,manual_label,prediction,sea_surface_h,bathy_h" << endl;
-    for (size_t i = 0; i < p.size (); ++i)
+    if (header)
+        os << "index_ph,x_atc,geoid_corr_h,manual_label,prediction,sea_surface_h,bathy_h\n";
+    csv::write_rows (os, p.size (), [&](string &s, const size_t i)
     {
         // Write the index
-        os << fixed;
-        os << p[i].h5_index;
-        os << setprecision (4) << fixed;;
-        os << "," << p[i].x;
-        os << setprecision (4) << fixed;;
-        os << "," << p[i].z;
+        csv::append_integer (s, p[i].h5_index);
+        s += ',';
+        csv::append_fixed (s, p[i].x, 4);
+        s += ',';
+        csv::append_fixed (s, p[i].z, 4);
         // Write the class
-        os << setprecision (0) << fixed;;
-        os << "," << p[i].cls;
+        s += ',';
+        csv::append_integer (s, p[i].cls);
         // Write the prediction
-        os << setprecision (0) << fixed;
-        os << "," << p[i].prediction;
+        s += ',';
+        csv::append_integer (s, p[i].prediction);
         // Write the surface estimate
-        os << setprecision (4) << fixed;
-        os << "," << p[i].surface_elevation;
+        s += ',';
+        csv::append_fixed (s, p[i].surface_elevation, 4);
         // Write the bathy estimate
-        os << setprecision (4) << fixed;
-        os << "," << p[i].bathy_elevation;
-        os << endl;
-    }
+        s += ',';
+        csv::append_fixed (s, p[i].bathy_elevation, 4);
+        s += '\n';
+    }, threads);
+}
 
-    // Restore precision
-    os.precision (pr);
+// Write the same columns as write_classified_point2d (), but as a
+// columnar table with full precision values
+//
+// The values are converted as they are written, so the points are not
+// copied into columns first.
+template<typename T>
+void write_classified_point2d_columnar (std::ostream &os, const T &p)
+{
+    using namespace std;
+
+    columnar::writer w (p.size ());
+    w.add_column<int64_t> (PI_NAME, [&] (const size_t i) { return p[i].h5_index; });
+    w.add_column<double> (X_NAME, [&] (const size_t i) { return p[i].x; });
+    w.add_column<double> (Z_NAME, [&] (const size_t i) { return p[i].z; });
+    w.add_column<int32_t> (LABEL_NAME, [&] (const size_t i) { return p[i].cls; });
+    w.add_column<int32_t> (PREDICTION_NAME, [&] (const size_t i) { return p[i].prediction; });
+    w.add_column<double> (SEA_SURFACE_NAME, [&] (const size_t i) { return p[i].surface_elevation; });
+    w.add_column<double> (BATHY_NAME, [&] (const size_t i) { return p[i].bathy_elevation; });
+    w.write (os);
 }
 
 struct point2d_extents
@@ -208,6 +281,8 @@ point2d_extents get_extents (const T &p,
     const size_t start_index,
     const size_t end_index)
 {
+    using namespace std;
+
     // Check invariants
     assert (start_index < end_index);
 
@@ -258,15 +333,21 @@ std::ostream &operator<< (std::ostream &os, const augmentation_params &ap)
     return os;
 }
 
+namespace detail
+{
+
+// Rasterize the points in [index_left, index_right) into the patch
+// 'r', which is centered on the point at 'index'
 template<typename T>
-ATL24_coastnet::raster::raster<unsigned char> create_raster (const T &p,
+void rasterize (const T &p,
     const size_t index,
-    const size_t rows,
-    const size_t cols,
+    const size_t index_left,
+    const size_t index_right,
     const double aspect_ratio,
-    const augmentation_params &ap = augmentation_params {},
-    const bool ap_enabled = false,
-    const size_t random_seed = 0)
+    const augmentation_params &ap,
+    const bool ap_enabled,
+    const size_t random_seed,
+    ATL24_coastnet::raster::raster<unsigned char> &r)
 {
     using namespace std;
 
@@ -275,44 +356,12 @@ ATL24_coastnet::raster::raster<unsigned char> create_raster (const T &p,
 
     // Check invariants
     assert (index < p.size ());
+    assert (index_left <= index);
+    assert (index < index_right);
+    assert (index_right <= p.size ());
 
-    // Create an empty raster
-    ATL24_coastnet::raster::raster<unsigned char> r (rows, cols);
-
-    // The point at 'index' will be centered in the patch
-    //
-    // Get size of patch in meters
-    const double width = cols * aspect_ratio;
-
-    // Find the left and right boundaries along the X axis of the patch
-    size_t index_left = index;
-    size_t index_right = index;
-
-    // Left boundary
-    while (index_left != 0)
-    {
-        // The values should be sorted by 'X'
-        assert (p[index].x >= p[index_left].x);
-
-        // Check the left boundary of the patch
-        if ((p[index].x - p[index_left].x) > width / 2.0)
-            break;
-
-        --index_left;
-    }
-
-    // Right boundary
-    while (index_right < p.size ())
-    {
-        // The values should be sorted by 'X'
-        assert (p[index_right].x >= p[index].x);
-
-        // Check the right boundary of the patch
-        if ((p[index_right].x - p[index].x) > width / 2.0)
-            break;
-
-        ++index_right;
-    }
+    const size_t rows = r.rows ();
+    const size_t cols = r.cols ();
 
     // Create augmentation distributions
     normal_distribution<double> jitter_x_dist (0.0, ap.jitter_x_std);
@@ -381,17 +430,224 @@ ATL24_coastnet::raster::raster<unsigned char> create_raster (const T &p,
         else
             r (patch_i, patch_j) = 2;
     }
+}
+
+} // namespace detail
+
+template<typename T>
+ATL24_coastnet::raster::raster<unsigned char> create_raster (const T &p,
+    const size_t index,
+    const size_t rows,
+    const size_t cols,
+    const double aspect_ratio,
+    const augmentation_params &ap = augmentation_params {},
+    const bool ap_enabled = false,
+    const size_t random_seed = 0)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (index < p.size ());
+
+    // Create an empty raster
+    ATL24_coastnet::raster::raster<unsigned char> r (rows, cols);
+
+    // The point at 'index' will be centered in the patch
+    //
+    // Get size of patch in meters
+    const double width = cols * aspect_ratio;
+
+    // Find the left and right boundaries along the X axis of the patch
+    size_t index_left = index;
+    size_t index_right = index;
+
+    // Left boundary
+    while (index_left != 0)
+    {
+        // The values should be sorted by 'X'
+        assert (p[index].x >= p[index_left].x);
+
+        // Check the left boundary of the patch
+        if ((p[index].x - p[index_left].x) > width / 2.0)
+            break;
+
+        --index_left;
+    }
+
+    // Right boundary
+    while (index_right < p.size ())
+    {
+        // The values should be sorted by 'X'
+        assert (p[index_right].x >= p[index].x);
+
+        // Check the right boundary of the patch
+        if ((p[index_right].x - p[index].x) > width / 2.0)
+            break;
+
+        ++index_right;
+    }
+
+    detail::rasterize (p, index, index_left, index_right, aspect_ratio, ap, ap_enabled, random_seed, r);
 
     return r;
 }
 
+// Create patches for many points along a track that is sorted by 'X'
+//
+// The builder remembers the patch boundaries from the previous call.
+// When points are visited in non-decreasing index order, the
+// boundaries only move forward, so finding them costs amortized O(1)
+// per point instead of a walk outward from each point. Visiting a
+// point behind the previous one is allowed, it just re-locates the
+// boundaries with a binary search.
+//
+// The patches are identical to the ones returned by create_raster().
 template<typename T>
-std::vector<ATL24_coastnet::classified_point2d> convert_dataframe (
-    const T &df,
-    bool &has_manual_label,
-    bool &has_predictions,
-    bool &has_surface_elevations,
-    bool &has_bathy_elevations)
+class patch_builder
+{
+    public:
+    patch_builder (const T &init_p,
+        const size_t init_rows,
+        const size_t init_cols,
+        const double init_aspect_ratio)
+        : p (init_p)
+        , rows (init_rows)
+        , cols (init_cols)
+        , aspect_ratio (init_aspect_ratio)
+        , half_width (init_cols * init_aspect_ratio / 2.0)
+        , started (false)
+        , last_index (0)
+        , total_left (0)
+        , index_right (0)
+    {
+    }
+    // Create the patch centered on the point at 'index' in 'r'
+    void create_raster (const size_t index,
+        ATL24_coastnet::raster::raster<unsigned char> &r,
+        const augmentation_params &ap = augmentation_params {},
+        const bool ap_enabled = false,
+        const size_t random_seed = 0)
+    {
+        // Check invariants
+        assert (index < p.size ());
+
+        // Move the boundaries
+        update (index);
+
+        // Start with an empty raster
+        if (r.rows () != rows || r.cols () != cols)
+            r = ATL24_coastnet::raster::raster<unsigned char> (rows, cols);
+        else
+            r.assign (0);
+
+        // The left boundary is the closest point that is too far
+        // away, just like create_raster()
+        const size_t index_left = total_left == 0 ? 0 : total_left - 1;
+
+        detail::rasterize (p, index, index_left, index_right, aspect_ratio, ap, ap_enabled, random_seed, r);
+    }
+    // Create the patch centered on the point at 'index'
+    ATL24_coastnet::raster::raster<unsigned char> create_raster (const size_t index,
+        const augmentation_params &ap = augmentation_params {},
+        const bool ap_enabled = false,
+        const size_t random_seed = 0)
+    {
+        ATL24_coastnet::raster::raster<unsigned char> r (rows, cols);
+        create_raster (index, r, ap, ap_enabled, random_seed);
+        return r;
+    }
+
+    private:
+    const T &p;
+    const size_t rows;
+    const size_t cols;
+    const double aspect_ratio;
+    const double half_width;
+    bool started;
+    size_t last_index;
+    // Number of points that are too far to the left of the center point
+    size_t total_left;
+    // Index of the first point that is too far to the right of the center point
+    size_t index_right;
+
+    bool too_far_left (const size_t index, const size_t i) const
+    {
+        // The values should be sorted by 'X'
+        assert (p[index].x >= p[i].x);
+        return (p[index].x - p[i].x) > half_width;
+    }
+    bool too_far_right (const size_t index, const size_t i) const
+    {
+        // The values should be sorted by 'X'
+        assert (p[i].x >= p[index].x);
+        return (p[i].x - p[index].x) > half_width;
+    }
+    void update (const size_t index)
+    {
+        if (!started || index < last_index)
+        {
+            // Binary search for the first point that is not too far left
+            size_t lo = 0;
+            size_t hi = index;
+            while (lo < hi)
+            {
+                const size_t mid = lo + (hi - lo) / 2;
+                if (too_far_left (index, mid))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            total_left = lo;
+
+            // Binary search for the first point that is too far right
+            lo = index;
+            hi = p.size ();
+            while (lo < hi)
+            {
+                const size_t mid = lo + (hi - lo) / 2;
+                if (too_far_right (index, mid))
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            index_right = lo;
+
+            started = true;
+        }
+        else
+        {
+            // The center point moved right, so the boundaries can only
+            // move right
+            while (total_left < index && too_far_left (index, total_left))
+                ++total_left;
+
+            index_right = std::max (index_right, index);
+            while (index_right < p.size () && !too_far_right (index, index_right))
+                ++index_right;
+        }
+
+        last_index = index;
+    }
+};
+
+namespace detail
+{
+
+// The columns of a dataframe that hold each field of a photon
+struct dataframe_columns
+{
+    std::optional<size_t> h5_index;
+    std::optional<size_t> x;
+    std::optional<size_t> z;
+    std::optional<size_t> cls;
+    std::optional<size_t> prediction;
+    std::optional<size_t> surface_elevation;
+    std::optional<size_t> bathy_elevation;
+};
+
+// Resolve the columns we are interested in
+template<typename T>
+dataframe_columns get_dataframe_columns (const T &df)
 {
     using namespace std;
 
@@ -400,55 +656,91 @@ std::vector<ATL24_coastnet::classified_point2d> convert_dataframe (
     assert (df.rows () != 0);
     assert (df.cols () != 0);
 
-    // Get number of photons in this file
-    const size_t nrows = df.rows ();
+    const auto find_column = [&] (const std::string &name) -> std::optional<size_t>
+    {
+        if (!df.has_column (name))
+            return std::nullopt;
+        return df.get_column_index (name);
+    };
 
-    // Get the columns we are interested in
-    const auto headers = df.get_headers ();
-    auto pi_it = find (headers.begin(), headers.end(), PI_NAME);
-    auto x_it = find (headers.begin(), headers.end(), X_NAME);
-    auto z_it = find (headers.begin(), headers.end(), Z_NAME);
-    auto cls_it = find (headers.begin(), headers.end(), LABEL_NAME);
-    auto prediction_it = find (headers.begin(), headers.end(), PREDICTION_NAME);
-    auto surface_elevation_it = find (headers.begin(), headers.end(), SEA_SURFACE_NAME);
-    auto bathy_elevation_it = find (headers.begin(), headers.end(), BATHY_NAME);
+    dataframe_columns c;
+    c.h5_index = find_column (PI_NAME);
+    c.x = find_column (X_NAME);
+    c.z = find_column (Z_NAME);
+    c.cls = find_column (LABEL_NAME);
+    c.prediction = find_column (PREDICTION_NAME);
+    c.surface_elevation = find_column (SEA_SURFACE_NAME);
+    c.bathy_elevation = find_column (BATHY_NAME);
 
-    if (pi_it == headers.end ())
+    if (!c.h5_index)
         throw runtime_error ("Can't find 'index_ph' in dataframe");
-    if (x_it == headers.end ())
+    if (!c.x)
         throw runtime_error ("Can't find 'x_atc' in dataframe");
-    if (z_it == headers.end ())
+    if (!c.z)
         throw runtime_error ("Can't find 'geoid_corr_h' in dataframe");
 
-    has_manual_label = cls_it != headers.end ();
-    has_predictions = prediction_it != headers.end ();
-    has_surface_elevations = surface_elevation_it != headers.end ();
-    has_bathy_elevations = bathy_elevation_it != headers.end ();
+    return c;
+}
 
-    // Stuff values into the vector
-    std::vector<ATL24_coastnet::classified_point2d> dataset (nrows);
+// Call 'set (i, value)' with each value in a dataframe column, if the
+// column exists
+//
+// At most 'threads' threads are used, 0 means use all available threads.
+template<typename T,typename F>
+void copy_column (const T &df, const std::optional<size_t> &col, const size_t threads, const F &set)
+{
+    if (!col)
+        return;
 
-    for (size_t i = 0; i < nrows; ++i)
+    const int nthreads = threads == 0 ? omp_get_max_threads () : threads;
+    df.visit_column (*col, [&] (const auto values)
     {
-        // Make assignments
-        dataset[i].h5_index = df.get_value (PI_NAME, i);
-        dataset[i].x = df.get_value (X_NAME, i);
-        dataset[i].z = df.get_value (Z_NAME, i);
-        if (has_manual_label)
-            dataset[i].cls = df.get_value (LABEL_NAME, i);
-        if (has_predictions)
-            dataset[i].prediction = df.get_value (PREDICTION_NAME, i);
-        if (has_surface_elevations)
-            dataset[i].surface_elevation = df.get_value (SEA_SURFACE_NAME, i);
-        if (has_bathy_elevations)
-            dataset[i].bathy_elevation = df.get_value (BATHY_NAME, i);
-    }
+        assert (values.size () == df.rows ());
+#pragma omp parallel for num_threads(nthreads)
+        for (size_t i = 0; i < values.size (); ++i)
+            set (i, values[i]);
+    });
+}
+
+} // namespace detail
+
+// Copy the points in a dataframe or a columnar table
+//
+// At most 'threads' threads are used, 0 means use all available threads.
+template<typename T>
+std::vector<ATL24_coastnet::classified_point2d> convert_dataframe (
+    const T &df,
+    bool &has_manual_label,
+    bool &has_predictions,
+    bool &has_surface_elevations,
+    bool &has_bathy_elevations,
+    const size_t threads = 0)
+{
+    using namespace std;
+
+    const auto c = detail::get_dataframe_columns (df);
+
+    has_manual_label = c.cls.has_value ();
+    has_predictions = c.prediction.has_value ();
+    has_surface_elevations = c.surface_elevation.has_value ();
+    has_bathy_elevations = c.bathy_elevation.has_value ();
+
+    // Stuff values into the vector, one column at a time
+    std::vector<ATL24_coastnet::classified_point2d> dataset (df.rows ());
+
+    detail::copy_column (df, c.h5_index, threads, [&] (const size_t i, const auto v) { dataset[i].h5_index = v; });
+    detail::copy_column (df, c.x, threads, [&] (const size_t i, const auto v) { dataset[i].x = v; });
+    detail::copy_column (df, c.z, threads, [&] (const size_t i, const auto v) { dataset[i].z = v; });
+    detail::copy_column (df, c.cls, threads, [&] (const size_t i, const auto v) { dataset[i].cls = v; });
+    detail::copy_column (df, c.prediction, threads, [&] (const size_t i, const auto v) { dataset[i].prediction = v; });
+    detail::copy_column (df, c.surface_elevation, threads, [&] (const size_t i, const auto v) { dataset[i].surface_elevation = v; });
+    detail::copy_column (df, c.bathy_elevation, threads, [&] (const size_t i, const auto v) { dataset[i].bathy_elevation = v; });
 
     return dataset;
 }
 
 template<typename T>
-std::vector<ATL24_coastnet::classified_point2d> convert_dataframe (const T &df)
+std::vector<ATL24_coastnet::classified_point2d> convert_dataframe (const T &df, const size_t threads = 0)
 {
     bool has_manual_label;
     bool has_predictions;
@@ -459,13 +751,15 @@ std::vector<ATL24_coastnet::classified_point2d> convert_dataframe (const T &df)
         has_manual_label,
         has_predictions,
         has_surface_elevations,
-        has_bathy_elevations);
+        has_bathy_elevations,
+        threads);
 }
 
 template<typename T>
 std::vector<ATL24_coastnet::classified_point2d> convert_dataframe (const T &df,
     bool &has_manual_label,
-    bool &has_predictions)
+    bool &has_predictions,
+    const size_t threads = 0)
 {
     bool has_surface_elevations;
     bool has_bathy_elevations;
@@ -474,7 +768,8 @@ std::vector<ATL24_coastnet::classified_point2d> convert_dataframe (const T &df,
         has_manual_label,
         has_predictions,
         has_surface_elevations,
-        has_bathy_elevations);
+        has_bathy_elevations,
+        threads);
 }
 
 } // namespace ATL24_coastnet
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "precompiled.h"
+#include "json.h"
+#include "timer.h"
 
 namespace ATL24_coastnet
 {
@@ -37,6 +39,368 @@ void call_xgboost (F f, Args... args)
 
 }
 
+// Features in compressed sparse row (CSR) format
+//
+// Only the non-zero values of each row are stored. Row 'i' is made up
+// of the entries in [indptr[i], indptr[i + 1]).
+struct sparse_features
+{
+    std::vector<size_t> indptr;
+    std::vector<uint32_t> indices;
+    std::vector<float> values;
+
+    size_t rows () const
+    {
+        return indptr.empty () ? 0 : indptr.size () - 1;
+    }
+    void clear ()
+    {
+        indptr.assign (1, 0);
+        indices.clear ();
+        values.clear ();
+    }
+};
+
+// Expand sparse features into a row-major 'rows' x 'cols' matrix
+//
+// Features that are not stored are 0.
+inline std::vector<float> to_dense (const sparse_features &features, const size_t cols)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (features.indptr.back () == features.values.size ());
+    assert (features.indices.size () == features.values.size ());
+
+    const size_t rows = features.rows ();
+    vector<float> f (rows * cols, 0.0f);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        for (size_t j = features.indptr[i]; j < features.indptr[i + 1]; ++j)
+        {
+            assert (features.indices[j] < cols);
+            f[i * cols + features.indices[j]] = features.values[j];
+        }
+    }
+
+    return f;
+}
+
+// Get the sorted, unique thresholds of a saved model's splits on the
+// elevation, which is always feature 0
+inline std::vector<float> get_elevation_splits (const json::value &model)
+{
+    using namespace std;
+
+    vector<float> splits;
+    const auto &trees = model["learner"]["gradient_booster"]["model"]["trees"];
+    for (size_t i = 0; i < trees.size (); ++i)
+    {
+        const auto &left_children = trees[i]["left_children"];
+        const auto &split_indices = trees[i]["split_indices"];
+        const auto &split_conditions = trees[i]["split_conditions"];
+
+        for (size_t j = 0; j < left_children.size (); ++j)
+        {
+            // Ignore leaves
+            if (left_children[j].as_number () == -1)
+                continue;
+            if (split_indices[j].as_number () == 0)
+                splits.push_back (split_conditions[j].as_float ());
+        }
+    }
+
+    sort (splits.begin (), splits.end ());
+    splits.erase (unique (splits.begin (), splits.end ()), splits.end ());
+    return splits;
+}
+
+// Get the array interface type string for 'T'
+template<typename T>
+std::string array_interface_typestr ()
+{
+    using namespace std;
+
+    if constexpr (is_same_v<T, float>)
+        return "<f4";
+    else if constexpr (is_same_v<T, uint8_t>)
+        return "|u1";
+    else if constexpr (is_same_v<T, uint32_t>)
+        return "<u4";
+    else if constexpr (is_same_v<T, uint64_t>)
+        return "<u8";
+    else
+        static_assert (sizeof (T) == 0, "Unsupported array interface type");
+}
+
+// Get a JSON array interface string that describes 'n' values at 'data'
+//
+// See: https://numpy.org/doc/stable/reference/arrays.interface.html
+template<typename T>
+std::string array_interface (const T *data, const size_t n)
+{
+    using namespace std;
+
+    return string ("{\"data\": [")
+        + to_string (reinterpret_cast<uintptr_t> (data))
+        + ", true], \"shape\": ["
+        + to_string (n)
+        + "], \"typestr\": \""
+        + array_interface_typestr<T> ()
+        + "\", \"version\": 3}";
+}
+
+// Was libxgboost built with CUDA?
+inline bool has_cuda ()
+{
+    using namespace std;
+
+    const char *out = nullptr;
+    call_xgboost (XGBuildInfo, &out);
+    const auto info = json::parse (string (out));
+    return info.contains ("USE_CUDA") && info["USE_CUDA"].as_boolean ();
+}
+
+// Get a JSON array interface string that describes a row-major
+// 'rows' x 'cols' matrix at 'data'
+template<typename T>
+std::string array_interface (const T *data, const size_t rows, const size_t cols)
+{
+    using namespace std;
+
+    return string ("{\"data\": [")
+        + to_string (reinterpret_cast<uintptr_t> (data))
+        + ", true], \"shape\": ["
+        + to_string (rows)
+        + ", "
+        + to_string (cols)
+        + "], \"typestr\": \""
+        + array_interface_typestr<T> ()
+        + "\", \"version\": 3}";
+}
+
+// Get each sample's weight from how often its class occurs
+inline std::vector<float> get_class_weights (const std::vector<uint32_t> &labels)
+{
+    using namespace std;
+
+    // Count occurrance of each class
+    unordered_map<uint32_t,double> counts;
+    for (size_t i = 0; i < labels.size (); ++i)
+        ++counts[labels[i]];
+
+    // Determine the weights from the counts
+    vector<float> w (labels.size ());
+    for (size_t i = 0; i < w.size (); ++i)
+        w[i] = counts[labels[i]] / labels.size ();
+
+    return w;
+}
+
+// Get a JSON array interface string that describes 'n' values at
+// 'data', 'stride' bytes apart
+template<typename T>
+std::string strided_array_interface (const T *data, const size_t n, const size_t stride)
+{
+    using namespace std;
+
+    return string ("{\"data\": [")
+        + to_string (reinterpret_cast<uintptr_t> (data))
+        + ", true], \"shape\": ["
+        + to_string (n)
+        + "], \"strides\": ["
+        + to_string (stride)
+        + "], \"typestr\": \""
+        + array_interface_typestr<T> ()
+        + "\", \"version\": 3}";
+}
+
+// Samples whose first feature is a float elevation, and whose other
+// features are the byte cells of a patch
+//
+// Row 'i' is elevations[i], followed by the 'cells_per_row' bytes at
+// cells + i * pitch. The memory belongs to the caller.
+struct patch_features
+{
+    size_t rows = 0;
+    const float *elevations = nullptr;
+    const uint8_t *cells = nullptr;
+    size_t cells_per_row = 0;
+    size_t pitch = 0;
+
+    size_t cols () const
+    {
+        return cells_per_row + 1;
+    }
+};
+
+// Get a JSON columnar interface string that describes rows [begin, end)
+// of 'f'
+//
+// Each feature is a column: the elevations are contiguous, and each
+// cell is a strided view into the patches, so XGBoost reads the bytes
+// in place, and they never get expanded into floats.
+inline std::string columnar_interface (const patch_features &f, const size_t begin, const size_t end)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (begin <= end);
+    assert (end <= f.rows);
+    assert (f.cells_per_row <= f.pitch);
+
+    const size_t n = end - begin;
+    string s = "[" + array_interface (f.elevations + begin, n);
+    for (size_t j = 0; j < f.cells_per_row; ++j)
+        s += ", " + strided_array_interface (f.cells + begin * f.pitch + j, n, f.pitch);
+    s += "]";
+
+    return s;
+}
+
+// Feed training samples to XGBoost one batch at a time
+//
+// XGBoost's DataIter callbacks call next () to get each batch, and
+// reset () to start over. 'get_features (begin, end, f)' fills 'f' with
+// the row-major features of samples [begin, end), so only one batch of
+// features is in memory at a time. Patches are instead passed to
+// XGBoost in place, one range of rows at a time. The labels and
+// weights are small, and are always passed in place.
+class batch_iterator
+{
+    public:
+    using feature_function = std::function<void (size_t, size_t, float *)>;
+
+    batch_iterator (const feature_function &init_get_features,
+        const std::vector<uint32_t> &init_labels,
+        const size_t init_cols,
+        const size_t init_batch_size)
+        : get_features (init_get_features)
+        , labels (init_labels)
+        , weights (get_class_weights (labels))
+        , cols (init_cols)
+        , batch_size (init_batch_size)
+        , current (0)
+    {
+        // Check invariants
+        assert (batch_size != 0);
+
+        call_xgboost (XGProxyDMatrixCreate, &proxy);
+    }
+    batch_iterator (const patch_features &init_patches,
+        const std::vector<uint32_t> &init_labels,
+        const size_t init_batch_size)
+        : patches (init_patches)
+        , labels (init_labels)
+        , weights (get_class_weights (labels))
+        , cols (init_patches.cols ())
+        , batch_size (init_batch_size)
+        , current (0)
+    {
+        // Check invariants
+        assert (batch_size != 0);
+        assert (patches->rows == labels.size ());
+
+        call_xgboost (XGProxyDMatrixCreate, &proxy);
+    }
+    batch_iterator (const batch_iterator &) = delete;
+    batch_iterator &operator= (const batch_iterator &) = delete;
+    ~batch_iterator ()
+    {
+        XGDMatrixFree (proxy);
+    }
+    DMatrixHandle get_proxy () const
+    {
+        return proxy;
+    }
+    size_t rows () const
+    {
+        return labels.size ();
+    }
+    // XGBoost callbacks
+    //
+    // Exceptions can't cross the C API, so they are saved, and
+    // rethrown by rethrow_if_failed ().
+    static int next (DataIterHandle handle)
+    {
+        auto it = static_cast<batch_iterator *> (handle);
+        try
+        {
+            return it->next_batch ();
+        }
+        catch (...)
+        {
+            it->error = std::current_exception ();
+            return 0;
+        }
+    }
+    static void reset (DataIterHandle handle)
+    {
+        static_cast<batch_iterator *> (handle)->current = 0;
+    }
+    void rethrow_if_failed () const
+    {
+        if (error)
+            std::rethrow_exception (error);
+    }
+
+    private:
+    feature_function get_features;
+    std::optional<patch_features> patches;
+    const std::vector<uint32_t> &labels;
+    std::vector<float> weights;
+    size_t cols;
+    size_t batch_size;
+    size_t current;
+    std::vector<float> features;
+    DMatrixHandle proxy;
+    std::exception_ptr error;
+
+    // Returns 0 when there are no more batches
+    int next_batch ()
+    {
+        using namespace std;
+
+        if (current == rows () || error)
+            return 0;
+
+        const size_t begin = current;
+        const size_t end = std::min (rows (), begin + batch_size);
+        const size_t n = end - begin;
+
+        // XGBoost uses the batch until the next call
+        if (patches)
+        {
+            call_xgboost (XGProxyDMatrixSetDataColumnar, proxy, columnar_interface (*patches, begin, end).c_str ());
+        }
+        else
+        {
+            features.resize (n * cols);
+            get_features (begin, end, &features[0]);
+
+            call_xgboost (XGProxyDMatrixSetDataDense, proxy, array_interface (&features[0], n, cols).c_str ());
+        }
+        call_xgboost (XGDMatrixSetInfoFromInterface, proxy, "label", array_interface (&labels[begin], n).c_str ());
+        call_xgboost (XGDMatrixSetInfoFromInterface, proxy, "weight", array_interface (&weights[begin], n).c_str ());
+
+        current = end;
+        return 1;
+    }
+};
+
+// Parameters for histogram training on the CPU
+struct hist_params
+{
+    // XGBoost threads, 0 means use them all
+    size_t threads = 0;
+    // Bins per feature
+    //
+    // Only the elevation needs more than a few: a raster cell only takes
+    // a few distinct values, and a feature never gets more bins than it
+    // has values.
+    size_t max_bin = 256;
+};
+
 // Helper class for XGBoost DMatrix allocation
 class dmatrix
 {
@@ -45,6 +409,58 @@ class dmatrix
     {
         call_xgboost (XGDMatrixCreateFromMat, &features[0], rows, cols, constants::missing_data, &handle);
     }
+    // Create a DMatrix from patches, without copying them first
+    explicit dmatrix (const patch_features &f)
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (f.rows != 0);
+
+        char buffer[32];
+        const auto r = to_chars (buffer, buffer + sizeof (buffer), constants::missing_data);
+        const string config = "{\"missing\": " + string (buffer, r.ptr) + ", \"nthread\": 0}";
+
+        call_xgboost (XGDMatrixCreateFromColumnar, columnar_interface (f, 0, f.rows).c_str (), config.c_str (), &handle);
+    }
+    // Create an external memory DMatrix from batches
+    //
+    // XGBoost reads the batches once, and keeps its own copy of them
+    // in cache files that start with 'cache_prefix'.
+    dmatrix (batch_iterator &it, const std::string &cache_prefix)
+    {
+        using namespace std;
+
+        json::value prefix;
+        prefix.set_string (cache_prefix);
+
+        char buffer[32];
+        const auto r = to_chars (buffer, buffer + sizeof (buffer), constants::missing_data);
+        const string config = "{\"missing\": " + string (buffer, r.ptr)
+            + ", \"cache_prefix\": " + json::dump (prefix) + "}";
+
+        const int err = XGDMatrixCreateFromCallback (&it, it.get_proxy (), batch_iterator::reset, batch_iterator::next, config.c_str (), &handle);
+        check_created (err, it, "external memory DMatrix");
+    }
+    // Create a QuantileDMatrix from batches
+    //
+    // XGBoost quantizes each batch into its histogram bins as it reads
+    // it, so it never keeps a float copy of the features.
+    dmatrix (batch_iterator &it, const hist_params &hp)
+    {
+        using namespace std;
+
+        char buffer[32];
+        const auto r = to_chars (buffer, buffer + sizeof (buffer), constants::missing_data);
+        const string config = "{\"missing\": " + string (buffer, r.ptr)
+            + ", \"nthread\": " + to_string (hp.threads)
+            + ", \"max_bin\": " + to_string (hp.max_bin) + "}";
+
+        const int err = XGQuantileDMatrixCreateFromCallback (&it, it.get_proxy (), nullptr, batch_iterator::reset, batch_iterator::next, config.c_str (), &handle);
+        check_created (err, it, "QuantileDMatrix");
+    }
+    dmatrix (const dmatrix &) = delete;
+    dmatrix &operator= (const dmatrix &) = delete;
     DMatrixHandle *get_handle_address ()
     {
         return &handle;
@@ -55,18 +471,7 @@ class dmatrix
     }
     void add_weights (const std::vector<uint32_t> &labels)
     {
-        using namespace std;
-
-        // Count occurrance of each class
-        unordered_map<uint32_t,double> counts;
-        for (size_t i = 0; i < labels.size (); ++i)
-            ++counts[labels[i]];
-
-        // Determine the weights from the counts
-        vector<float> w (labels.size ());
-        for (size_t i = 0; i < w.size (); ++i)
-            w[i] = counts[labels[i]] / labels.size ();
-
+        const auto w = get_class_weights (labels);
         call_xgboost (XGDMatrixSetFloatInfo, handle, "weight", &w[0], w.size ());
     }
     ~dmatrix ()
@@ -76,6 +481,29 @@ class dmatrix
 
     private:
     DMatrixHandle handle;
+
+    // Throw if creating a DMatrix from 'it' failed
+    //
+    // A failed callback just ends the batches, so XGBoost can still
+    // create the DMatrix. Free it before rethrowing the callback's error.
+    void check_created (const int err, const batch_iterator &it, const std::string &what)
+    {
+        if (err != 0)
+        {
+            it.rethrow_if_failed ();
+            throw std::runtime_error ("Could not create " + what + ": " + XGBGetLastError ());
+        }
+
+        try
+        {
+            it.rethrow_if_failed ();
+        }
+        catch (...)
+        {
+            XGDMatrixFree (handle);
+            throw;
+        }
+    }
 };
 
 // XGBooster model interface
@@ -96,6 +524,8 @@ class xgbooster
         : verbose (init_verbose)
         , initialized (false)
         , trained (false)
+        , sparse (false)
+        , gpu (false)
     {
     }
     ~xgbooster ()
@@ -129,6 +559,281 @@ class xgbooster
         m.add_labels (labels);
         m.add_weights (labels);
 
+        train (m, epochs, use_gpu);
+    }
+    // Train on patches, see patch_features
+    //
+    // XGBoost reads the bytes in place, so the features never get
+    // expanded into a float matrix.
+    void train (const patch_features &features,
+        const std::vector<uint32_t> &labels,
+        const size_t epochs = 100,
+        const bool use_gpu = true)
+    {
+        using namespace std;
+
+        if (verbose)
+            clog << "Training from patches" << endl;
+
+        // Check invariants
+        assert (features.rows == labels.size ());
+
+        // Create the DMatrix
+        dmatrix m (features);
+        m.add_labels (labels);
+        m.add_weights (labels);
+
+        train (m, epochs, use_gpu);
+    }
+    // Train on patches with the CPU histogram method
+    //
+    // The patches are quantized straight into a QuantileDMatrix,
+    // 'batch_size' samples at a time, without being copied.
+    void train_hist (const patch_features &features,
+        const std::vector<uint32_t> &labels,
+        const size_t batch_size,
+        const size_t epochs = 100,
+        const hist_params &hp = hist_params ())
+    {
+        using namespace std;
+
+        if (verbose)
+            clog << "Training from patches on the CPU using "
+                << (hp.threads == 0 ? string ("all") : to_string (hp.threads))
+                << " threads" << endl;
+
+        // Check invariants
+        assert (features.rows == labels.size ());
+        assert (features.rows != 0);
+
+        batch_iterator it (features, labels, batch_size);
+        dmatrix m (it, hp);
+
+        train (m, epochs, false, hp);
+    }
+    // Train from batches of features, using XGBoost's external memory
+    //
+    // See batch_iterator. The features are never all in memory at
+    // once, so training memory depends on 'batch_size', not on the
+    // number of samples.
+    void train_in_batches (const batch_iterator::feature_function &get_features,
+        const std::vector<uint32_t> &labels,
+        const size_t cols,
+        const std::string &cache_prefix,
+        const size_t batch_size,
+        const size_t epochs = 100,
+        const bool use_gpu = true)
+    {
+        using namespace std;
+
+        if (verbose)
+            clog << "Training from batches of " << batch_size << " samples" << endl;
+
+        // Check invariants
+        assert (!labels.empty ());
+        assert (!cache_prefix.empty ());
+
+        batch_iterator it (get_features, labels, cols, batch_size);
+        dmatrix m (it, cache_prefix);
+
+        train (m, epochs, use_gpu);
+    }
+    void save_model (const std::string &filename) const
+    {
+        using namespace std;
+        if (verbose)
+            clog << "Saving model to " << filename << endl;
+
+        call_xgboost (XGBoosterSaveModel, booster, filename.c_str ());
+    }
+    void load_model (const std::string &filename, const bool use_gpu = false)
+    {
+        using namespace std;
+
+        // Initialize booster if needed
+        if (!initialized)
+        {
+            if (verbose)
+                clog << "Creating booster" << endl;
+
+            call_xgboost (XGBoosterCreate, nullptr, 0, &booster);
+            initialized = true;
+        }
+
+        if (verbose)
+            clog << "Loading model from " << filename << endl;
+
+        call_xgboost (XGBoosterLoadModel, booster, filename.c_str ());
+
+        // Configure the booster once, not every time we predict
+        set_device (use_gpu);
+    }
+    void set_device (const bool use_gpu)
+    {
+        // Check invariants
+        assert (initialized);
+
+        call_xgboost (XGBoosterSetParam, booster, "device", use_gpu ? "cuda" : "cpu");
+        gpu = use_gpu;
+    }
+    // Allow prediction on sparse features
+    //
+    // In a sparse feature matrix, values that are not stored are
+    // 'missing', and XGBoost sends missing values down each split's
+    // default branch. The features that we leave out are all 0, so
+    // change each split's default branch to the one that a 0 would
+    // take. After that, the sparse and dense features give the same
+    // predictions.
+    void enable_sparse_features ()
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (initialized);
+
+        if (sparse)
+            return;
+
+        if (verbose)
+            clog << "Setting default branches for sparse features" << endl;
+
+        // Get the model
+        bst_ulong len = 0;
+        const char *buffer = nullptr;
+        call_xgboost (XGBoosterSaveModelToBuffer, booster, "{\"format\": \"json\"}", &len, &buffer);
+        auto model = json::parse (string (buffer, len));
+
+        // Point each split's default branch in the direction of a 0
+        auto &trees = model["learner"]["gradient_booster"]["model"]["trees"];
+        for (size_t i = 0; i < trees.size (); ++i)
+        {
+            const auto &left_children = trees[i]["left_children"];
+            const auto &split_conditions = trees[i]["split_conditions"];
+            auto &default_left = trees[i]["default_left"];
+
+            for (size_t j = 0; j < default_left.size (); ++j)
+            {
+                // Ignore leaves
+                if (left_children[j].as_number () == -1)
+                    continue;
+
+                // XGBoost goes left when the value is less than the split condition
+                const float condition = split_conditions[j].as_number ();
+                default_left[j].set_boolean (0.0f < condition);
+            }
+        }
+
+        // Put it back
+        const auto tmp = json::dump (model);
+        call_xgboost (XGBoosterLoadModelFromBuffer, booster, tmp.c_str (), tmp.size ());
+        set_device (gpu);
+        sparse = true;
+    }
+    // Predict using a row-major 'rows' x 'cols' matrix of features
+    //
+    // Prediction is done in place, directly from the caller's buffer,
+    // so no DMatrix gets created. It is safe to call this function
+    // from more than one thread at a time.
+    std::vector<uint32_t> predict (const float *features,
+        const size_t rows,
+        const size_t cols) const
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (initialized);
+        assert (features != nullptr);
+        assert (rows != 0);
+
+        const auto values = array_interface (features, rows, cols);
+
+        // XGBoost keeps the results in thread local storage
+        const bst_ulong *shape = nullptr;
+        bst_ulong dim = 0;
+        const float *results = nullptr;
+        call_xgboost (XGBoosterPredictFromDense, booster, values.c_str (), dense_config ().c_str (), nullptr, &shape, &dim, &results);
+
+        return get_predictions (results, shape, dim, rows);
+    }
+    std::vector<uint32_t> predict (const std::vector<float> &features,
+        const size_t rows,
+        const size_t cols) const
+    {
+        // Check invariants
+        assert (!features.empty ());
+        assert (features.size () == rows * cols);
+
+        return predict (&features[0], rows, cols);
+    }
+    // Predict using sparse features
+    //
+    // Like the dense version, prediction is done in place and it is
+    // safe to call this function from more than one thread at a time.
+    std::vector<uint32_t> predict (const sparse_features &features,
+        const size_t cols) const
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (sparse);
+        assert (features.rows () != 0);
+        assert (features.indptr.back () == features.values.size ());
+        assert (features.indices.size () == features.values.size ());
+
+        static_assert (sizeof (size_t) == sizeof (uint64_t));
+        const auto indptr = array_interface (reinterpret_cast<const uint64_t *> (&features.indptr[0]), features.indptr.size ());
+        const auto indices = array_interface (&features.indices[0], features.indices.size ());
+        const auto values = array_interface (&features.values[0], features.values.size ());
+
+        // XGBoost keeps the results in thread local storage
+        const bst_ulong *shape = nullptr;
+        bst_ulong dim = 0;
+        const float *results = nullptr;
+        call_xgboost (XGBoosterPredictFromCSR, booster, indptr.c_str (), indices.c_str (), values.c_str (), cols, sparse_config ().c_str (), nullptr, &shape, &dim, &results);
+
+        return get_predictions (results, shape, dim, features.rows ());
+    }
+    bool is_sparse () const
+    {
+        return sparse;
+    }
+    std::vector<float> get_elevation_splits () const
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (initialized);
+
+        bst_ulong len = 0;
+        const char *buffer = nullptr;
+        call_xgboost (XGBoosterSaveModelToBuffer, booster, "{\"format\": \"json\"}", &len, &buffer);
+        return xgboost::get_elevation_splits (json::parse (string (buffer, len)));
+    }
+
+    private:
+    const bool verbose;
+    bool initialized;
+    BoosterHandle booster;
+    bool trained;
+    bool sparse;
+    bool gpu;
+
+    // Train the booster on a DMatrix
+    //
+    // When 'hp' is set, the CPU histogram method is used with its
+    // parameters.
+    void train (dmatrix &m,
+        const size_t epochs,
+        const bool request_gpu,
+        const std::optional<hist_params> &hp = std::nullopt)
+    {
+        using namespace std;
+
+        // Fall back to the CPU if libxgboost can't use a GPU
+        const bool use_gpu = request_gpu && has_cuda ();
+        if (verbose && request_gpu && !use_gpu)
+            clog << "libxgboost was built without CUDA, so training will use the CPU" << endl;
+
         // Initialize booster if needed
         if (!initialized)
         {
@@ -137,8 +842,8 @@ class xgbooster
                     << (use_gpu ? "CUDA" : "CPU")
                     << endl;
             call_xgboost (XGBoosterCreate, m.get_handle_address (), 1, &booster);
-            call_xgboost (XGBoosterSetParam, booster, "device", use_gpu ? "cuda" : "cpu");
             initialized = true;
+            set_device (use_gpu);
         }
 
         // Set model parameters
@@ -154,11 +859,23 @@ class xgbooster
         //call_xgboost (XGBoosterSetParam, booster, "eta", to_string (constants::eta).c_str ());
         //call_xgboost (XGBoosterSetParam, booster, "num_boosting_rounds", to_string (constants::num_boosting_rounds).c_str ());
 
+        // The bins must match the ones in the QuantileDMatrix
+        if (hp)
+        {
+            call_xgboost (XGBoosterSetParam, booster, "tree_method", "hist");
+            call_xgboost (XGBoosterSetParam, booster, "nthread", to_string (hp->threads).c_str ());
+            call_xgboost (XGBoosterSetParam, booster, "max_bin", to_string (hp->max_bin).c_str ());
+        }
+
         // Do the training
+        double total_ms = 0.0;
         for (size_t i = 0; i < epochs; ++i)
         {
             // Train
+            timer t;
             call_xgboost (XGBoosterUpdateOneIter, booster, i, *m.get_handle_address ());
+            t.stop ();
+            total_ms += t.elapsed_ms ();
 
             // Evaluate
             const char* eval_names = "train";
@@ -168,71 +885,57 @@ class xgbooster
             if (verbose)
             {
                 clog << "Epoch " << i+1 << "/" << epochs << " :";
-                clog << eval_result << endl;
+                clog << eval_result;
+                clog << " " << t.elapsed_ms () << "ms" << endl;
             }
         }
 
+        if (verbose && epochs != 0)
+            clog << "Average time per iteration " << total_ms / epochs << "ms" << endl;
+
         trained = true;
     }
-    void save_model (const std::string &filename) const
-    {
-        using namespace std;
-        if (verbose)
-            clog << "Saving model to " << filename << endl;
 
-        call_xgboost (XGBoosterSaveModel, booster, filename.c_str ());
+    static std::string predict_config (const std::string &missing)
+    {
+        return "{\"training\": false,"
+            " \"type\": 0,"
+            " \"iteration_begin\": 0,"
+            " \"iteration_end\": 0,"
+            " \"strict_shape\": true,"
+            " \"cache_id\": 0,"
+            " \"missing\": " + missing + "}";
     }
-    void load_model (const std::string &filename)
+    static const std::string &dense_config ()
     {
         using namespace std;
 
-        // Initialize booster if needed
-        if (!initialized)
+        // Use the same missing value as the DMatrix
+        static const string config = [] ()
         {
-            if (verbose)
-                clog << "Creating booster" << endl;
-
-            call_xgboost (XGBoosterCreate, nullptr, 0, &booster);
-            initialized = true;
-        }
-
-        if (verbose)
-            clog << "Loading model from " << filename << endl;
-
-        call_xgboost (XGBoosterLoadModel, booster, filename.c_str ());
+            char buffer[32];
+            const auto r = to_chars (buffer, buffer + sizeof (buffer), constants::missing_data);
+            return predict_config (string (buffer, r.ptr));
+        } ();
+        return config;
     }
-    std::vector<uint32_t> predict (const std::vector<float> &features,
-        const size_t rows,
-        const size_t cols,
-        const bool use_gpu = false)
+    static const std::string &sparse_config ()
+    {
+        // Entries that are present are never missing, even if they are 0
+        static const std::string config = predict_config ("NaN");
+        return config;
+    }
+    static std::vector<uint32_t> get_predictions (const float *results,
+        [[maybe_unused]] const bst_ulong *shape,
+        [[maybe_unused]] const bst_ulong dim,
+        const size_t rows)
     {
         using namespace std;
 
         // Check invariants
-        assert (!features.empty ());
-        assert (features.size () == rows * cols);
-
-        // Set booster parameters
-        call_xgboost (XGBoosterSetParam, booster, "device", use_gpu ? "cuda" : "cpu");
-
-        // Create the DMatrix
-        dmatrix m (features, rows, cols);
-
-        char const config[] =
-            "{\"training\": false,"
-            " \"type\": 0,"
-            " \"iteration_begin\": 0,"
-            " \"iteration_end\": 0,"
-            " \"strict_shape\": true}";
-        const uint64_t *shape;
-        uint64_t dim;
-        const float *results = NULL;
-        call_xgboost (XGBoosterPredictFromDMatrix, booster, *m.get_handle_address (), config, &shape, &dim, &results);
-
-        // Check invariants
-        assert(dim == 2);
-        assert(shape[0] == rows);
-        assert(shape[1] == 1);
+        assert (dim == 2);
+        assert (shape[0] == rows);
+        assert (shape[1] == 1);
 
         vector<uint32_t> predictions (rows);
 
@@ -241,12 +944,6 @@ class xgbooster
 
         return predictions;
     }
-
-    private:
-    const bool verbose;
-    bool initialized;
-    BoosterHandle booster;
-    bool trained;
 };
 
 } // namespace xgboost
@@ -1,10 +1,279 @@
 #include "cmd_utils.h"
 #include "coastnet.h"
+#include "columnar.h"
 #include "dataframe.h"
+#include "photons.h"
+#include "streaming.h"
+#include "timer.h"
 #include "utils.h"
 #include "classify_cmd.h"
 
-const std::string usage {"classify [options] < filename.csv"};
+#ifdef ATL24_COASTNET_COMPILED_MODEL
+#include "compiled_model.h"
+#endif
+
+const std::string usage {"classify [options] < filename.csv\n"
+    "\tclassify [options] --file-list=<filename>\n"
+    "\n"
+    "\t--chunk-mb classifies each granule in chunks that fit in that many\n"
+    "\tmegabytes. It needs a file list of columnar files sorted by x_atc,\n"
+    "\tand it only writes CSV output, so it can't be used with --binary.\n"
+    "\tThe budget covers the photons in a chunk and its halo, one byte per\n"
+    "\tphoton in the granule, each thread's feature buffers, which are\n"
+    "\tabout 4MB, or 8MB with --cache, and the prediction cache. It does\n"
+    "\tnot cover the model, or the pages of the mapped input file.\n"
+    "\n"
+    "\t--cache-entries limits the prediction cache to that many patches,\n"
+    "\tabout 300 bytes each."};
+
+struct granule_timing
+{
+    size_t points = 0;
+    double read_ms = 0.0;
+    double classify_ms = 0.0;
+    double write_ms = 0.0;
+};
+
+// 'read_dataframe ()' gets the points, as a dataframe or a columnar table
+template<typename T,typename U,typename F>
+granule_timing classify_granule (const T &args,
+    const U &predictor,
+    const F &read_dataframe,
+    std::ostream &os)
+{
+    using namespace std;
+    using namespace ATL24_coastnet;
+
+    granule_timing gt;
+    timer t;
+
+    // Read the points, and convert them to the correct format. The
+    // dataframe is freed as soon as the photons have been copied out of
+    // it, so only one copy of the points is held while they are
+    // classified.
+    bool has_manual_label;
+    bool has_predictions;
+    photons p;
+    {
+        const auto df = read_dataframe ();
+        p = convert_dataframe_to_photons (df, has_manual_label, has_predictions, args.threads);
+    }
+
+    t.stop ();
+    gt.points = p.size ();
+    gt.read_ms = t.elapsed_ms ();
+
+    if (args.verbose)
+        clog << p.size () << " points read" << endl;
+
+    // 0 threads means use all available threads
+    classify_params cp;
+    cp.threads = args.threads;
+    cp.sparse = args.sparse;
+    cp.predictor = args.predictor;
+    cp.cache = args.cache;
+    cp.cache_entries = args.cache_entries;
+
+    // Classify them in place, in their original order
+    t.start ();
+    classify_in_place (args.verbose, p, predictor, cp);
+    t.stop ();
+    gt.classify_ms = t.elapsed_ms ();
+
+    // Write classified output
+    t.start ();
+    if (args.binary)
+        write_classified_point2d_columnar (os, p);
+    else
+        write_classified_point2d (os, p, true, args.threads);
+    t.stop ();
+    gt.write_ms = t.elapsed_ms ();
+
+    return gt;
+}
+
+// Classify a columnar file in along-track chunks
+//
+// Only one chunk is in memory at a time. The points must be sorted by
+// X.
+template<typename T,typename U>
+granule_timing classify_granule_in_chunks (const T &args,
+    const U &predictor,
+    const std::string &input_filename,
+    std::ostream &os)
+{
+    using namespace std;
+    using namespace ATL24_coastnet;
+
+    if (!is_regular_file (input_filename))
+        throw runtime_error ("Only regular files can be classified in chunks");
+    if (!columnar::is_columnar (input_filename))
+        throw runtime_error ("Only columnar files can be classified in chunks");
+    if (args.binary)
+        throw runtime_error ("Binary output is not supported when classifying in chunks");
+
+    granule_timing gt;
+    timer t;
+
+    // Map the file
+    const columnar::table table (input_filename);
+    const streaming::columnar_source source (table);
+
+    classify_params cp;
+    cp.threads = args.threads;
+    cp.sparse = args.sparse;
+    cp.predictor = args.predictor;
+    cp.cache = args.cache;
+    cp.cache_entries = args.cache_entries;
+
+    streaming::stream_params sp;
+    sp.chunk_size = streaming::get_chunk_size (args.chunk_mb << 20, source.size (), cp);
+
+    // Write each chunk as soon as it's classified
+    bool first_chunk = true;
+    auto write_chunk = [&] (const auto &q)
+    {
+        timer w;
+        write_classified_point2d (os, q, first_chunk, args.threads);
+        first_chunk = false;
+        w.stop ();
+        gt.write_ms += w.elapsed_ms ();
+    };
+
+    streaming::classify (args.verbose, source, write_chunk, predictor, cp, sp);
+
+    // Reading is interleaved with classifying
+    t.stop ();
+    gt.points = source.size ();
+    gt.classify_ms = t.elapsed_ms () - gt.write_ms;
+
+    return gt;
+}
+
+// The columns that classify uses, and the columns that don't need to be
+// stored as doubles
+const std::vector<std::string> input_columns { PI_NAME, X_NAME, Z_NAME, ATL24_coastnet::LABEL_NAME };
+const ATL24_coastnet::dataframe::column_types input_types {
+    { PI_NAME, ATL24_coastnet::columnar::column_type::int64 },
+    { ATL24_coastnet::LABEL_NAME, ATL24_coastnet::columnar::column_type::uint8 },
+};
+
+// Get the input/output filename pairs, one pair per line
+std::vector<std::pair<std::string,std::string>> read_file_list (const std::string &fn)
+{
+    using namespace std;
+
+    ifstream ifs (fn);
+    if (!ifs)
+        throw runtime_error ("Could not open file list for reading");
+
+    vector<pair<string,string>> filenames;
+    for (string line; getline (ifs, line); )
+    {
+        // Skip empty lines
+        if (line.empty ())
+            continue;
+
+        stringstream ss (line);
+        string input_filename;
+        string output_filename;
+        if (!(ss >> input_filename >> output_filename))
+            throw runtime_error ("Expected an input and an output filename in the file list: " + line);
+
+        filenames.push_back (make_pair (input_filename, output_filename));
+    }
+
+    return filenames;
+}
+
+// Classify stdin, or each file in the file list
+template<typename T,typename U>
+void run (const T &args, const U &predictor)
+{
+    using namespace std;
+    using namespace ATL24_coastnet;
+
+    // Classify a single file from stdin to stdout
+    if (args.file_list.empty ())
+    {
+        if (args.chunk_mb != 0)
+            throw runtime_error ("Classifying in chunks needs a file list");
+
+        if (args.verbose)
+            clog << "Reading points from stdin" << endl;
+
+        classify_granule (args, predictor, [&] { return dataframe::read (cin, input_columns, input_types, args.threads); }, cout);
+
+        return;
+    }
+
+    // Classify a list of files
+    const auto filenames = read_file_list (args.file_list);
+
+    if (args.verbose)
+        clog << filenames.size () << " files in " << args.file_list << endl;
+
+    // Allow each granule to use its own threads
+    omp_set_max_active_levels (2);
+
+    const int jobs = args.jobs == 0 ? omp_get_max_threads () : args.jobs;
+    size_t failed = 0;
+    timer t;
+
+    // Schedule the granules across the workers
+#pragma omp parallel for schedule(dynamic) num_threads(jobs)
+    for (size_t i = 0; i < filenames.size (); ++i)
+    {
+        const auto &input_filename = filenames[i].first;
+        const auto &output_filename = filenames[i].second;
+
+        try
+        {
+            // Opening and closing a pipe here would lose its writer
+            if (::access (input_filename.c_str (), R_OK) != 0)
+                throw runtime_error ("Could not open file for reading");
+
+            ofstream ofs (output_filename, ios::binary);
+            if (!ofs)
+                throw runtime_error ("Could not open file for writing");
+
+            // Map the file instead of streaming it. Columnar files are
+            // used in place. Pipes are read by dataframe::read ().
+            const auto gt = args.chunk_mb != 0
+                ? classify_granule_in_chunks (args, predictor, input_filename, ofs)
+                : columnar::is_columnar (input_filename)
+                ? classify_granule (args, predictor,
+                    [&] { return columnar::table (input_filename); }, ofs)
+                : classify_granule (args, predictor,
+                    [&] { return dataframe::read (input_filename, input_columns, input_types, args.threads); }, ofs);
+
+            // Report per-granule timing
+#pragma omp critical (classify_report)
+            clog << input_filename
+                << "\tpoints " << gt.points
+                << "\tread " << gt.read_ms << "ms"
+                << "\tclassify " << gt.classify_ms << "ms"
+                << "\twrite " << gt.write_ms << "ms"
+                << "\ttotal " << gt.read_ms + gt.classify_ms + gt.write_ms << "ms"
+                << endl;
+        }
+        catch (const exception &e)
+        {
+#pragma omp critical (classify_report)
+            {
+                cerr << input_filename << ": " << e.what () << endl;
+                ++failed;
+            }
+        }
+    }
+
+    t.stop ();
+    clog << "Classified " << filenames.size () - failed << " of " << filenames.size ()
+        << " files in " << t.elapsed_ms () << "ms" << endl;
+
+    if (failed != 0)
+        throw runtime_error (to_string (failed) + " files could not be classified");
+}
 
 int main (int argc, char **argv)
 {
@@ -26,31 +295,43 @@ int main (int argc, char **argv)
             clog << args;
             clog << "sampling parameters:" << endl;
             print_sampling_params (clog);
-            clog << "Reading points from stdin" << endl;
         }
 
-        // Read the points
-        const auto df = ATL24_coastnet::dataframe::read (cin);
-
-        // Convert it to the correct format
-        bool has_manual_label;
-        bool has_predictions;
-        const auto p = convert_dataframe (df, has_manual_label, has_predictions);
-
-        if (args.verbose)
-            clog << p.size () << " points read" << endl;
+        // Load the model once, no matter how many files get classified
+#ifdef ATL24_COASTNET_COMPILED_MODEL
+        if (args.predictor == "compiled")
+        {
+            if (args.verbose)
+                clog << "Using the model compiled from " << compiled_model::model_filename << endl;
 
-        // Classify them
-        const auto q = classify (args.verbose, p, args.model_filename);
-        assert (q.size () == p.size ());
+            run (args, compiled_model::predictor ());
+        }
+        else
+#endif
+        if (args.predictor == "native")
+        {
+            xgboost::tree_ensemble te (args.verbose);
+            te.load_model (args.model_filename);
+            run (args, te);
+        }
+        else if (args.predictor == "quickscorer")
+        {
+            xgboost::quickscorer qs (args.verbose);
+            qs.load_model (args.model_filename);
+            run (args, qs);
+        }
+        else if (args.predictor == "xgboost")
+        {
+            xgboost::xgbooster xgb (args.verbose);
+            xgb.load_model (args.model_filename);
 
-        // Ensure photon order did not change
-#pragma omp parallel for
-        for ([[maybe_unused]] size_t i = 0; i < q.size (); ++i)
-            assert (p[i].h5_index == q[i].h5_index);
+            if (args.sparse)
+                xgb.enable_sparse_features ();
 
-        // Write classified output to stdout
-        write_classified_point2d (cout, q);
+            run (args, xgb);
+        }
+        else
+            throw runtime_error ("Unknown predictor: " + args.predictor);
 
         return 0;
     }
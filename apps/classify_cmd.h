@@ -15,6 +15,19 @@ struct args
     bool verbose = false;
     size_t num_classes = 5;
     std::string model_filename = std::string ("./coastnet_model.pt");
+    size_t threads = 1;
+    bool sparse = false;
+    std::string file_list;
+    size_t jobs = 1;
+#ifdef ATL24_COASTNET_COMPILED_MODEL
+    std::string predictor = "compiled";
+#else
+    std::string predictor = "xgboost";
+#endif
+    bool cache = false;
+    size_t cache_entries = 1 << 16;
+    bool binary = false;
+    size_t chunk_mb = 0;
 };
 
 std::ostream &operator<< (std::ostream &os, const args &args)
@@ -24,6 +37,15 @@ std::ostream &operator<< (std::ostream &os, const args &args)
     os << "verbose: " << args.verbose << std::endl;
     os << "num-classes: " << args.num_classes << std::endl;
     os << "model-filename: " << args.model_filename << std::endl;
+    os << "threads: " << args.threads << std::endl;
+    os << "sparse: " << args.sparse << std::endl;
+    os << "file-list: " << args.file_list << std::endl;
+    os << "jobs: " << args.jobs << std::endl;
+    os << "predictor: " << args.predictor << std::endl;
+    os << "cache: " << args.cache << std::endl;
+    os << "cache-entries: " << args.cache_entries << std::endl;
+    os << "binary: " << args.binary << std::endl;
+    os << "chunk-mb: " << args.chunk_mb << std::endl;
     return os;
 }
 
@@ -38,10 +60,19 @@ args get_args (int argc, char **argv, const std::string &usage)
             {"verbose", no_argument, 0,  'v' },
             {"num-classes", required_argument, 0,  'c' },
             {"model-filename", required_argument, 0,  'f' },
+            {"threads", required_argument, 0,  't' },
+            {"sparse", no_argument, 0,  's' },
+            {"file-list", required_argument, 0,  'l' },
+            {"jobs", required_argument, 0,  'j' },
+            {"predictor", required_argument, 0,  'p' },
+            {"cache", no_argument, 0,  'a' },
+            {"cache-entries", required_argument, 0,  'e' },
+            {"binary", no_argument, 0,  'b' },
+            {"chunk-mb", required_argument, 0,  'm' },
             {0,      0,           0,  0 }
         };
 
-        int c = getopt_long(argc, argv, "hvc:f:", long_options, &option_index);
+        int c = getopt_long(argc, argv, "hvc:f:t:sl:j:p:ae:bm:", long_options, &option_index);
         if (c == -1)
             break;
 
@@ -60,6 +91,15 @@ args get_args (int argc, char **argv, const std::string &usage)
             case 'v': args.verbose = true; break;
             case 'c': args.num_classes = atol(optarg); break;
             case 'f': args.model_filename = std::string(optarg); break;
+            case 't': args.threads = atol(optarg); break;
+            case 's': args.sparse = true; break;
+            case 'l': args.file_list = std::string(optarg); break;
+            case 'j': args.jobs = atol(optarg); break;
+            case 'p': args.predictor = std::string(optarg); break;
+            case 'a': args.cache = true; break;
+            case 'e': args.cache_entries = atol(optarg); break;
+            case 'b': args.binary = true; break;
+            case 'm': args.chunk_mb = atol(optarg); break;
         }
     }
 
@@ -0,0 +1,279 @@
+#include "json.h"
+#include "tree_ensemble.h"
+#include "compile_model_cmd.h"
+
+using namespace std;
+using namespace ATL24_coastnet;
+
+const string usage {"compile_model [options]"};
+
+// Get a C++ float literal that holds exactly 'f'
+string float_literal (const float f)
+{
+    if (std::isnan (f))
+        return "std::numeric_limits<float>::quiet_NaN ()";
+    if (std::isinf (f))
+        return string (f < 0.0f ? "-" : "") + "std::numeric_limits<float>::infinity ()";
+
+    // The shortest representation that round trips
+    char buffer[64];
+    const auto r = to_chars (buffer, buffer + sizeof (buffer), f);
+    string s (buffer, r.ptr);
+
+    // Make sure it's not an integer literal
+    if (s.find_first_of (".e") == string::npos)
+        s += ".0";
+
+    return s + "f";
+}
+
+// Get a C++ string literal
+string string_literal (const string &s)
+{
+    string l ("\"");
+    for (auto c : s)
+    {
+        if (c == '"' || c == '\\')
+            l.push_back ('\\');
+        l.push_back (c);
+    }
+    return l + "\"";
+}
+
+// Write the branches for the subtree at 'node'
+void write_node (ostream &os, const json::value &tree, const size_t node, const size_t indent)
+{
+    const string pad (indent * 4, ' ');
+    const int left = tree["left_children"][node].as_number ();
+
+    // Leaves store their value in the split condition
+    if (left == -1)
+    {
+        os << pad << "return " << float_literal (tree["split_conditions"][node].as_float ()) << ";" << endl;
+        return;
+    }
+
+    const int right = tree["right_children"][node].as_number ();
+    const size_t split_index = tree["split_indices"][node].as_number ();
+    const float condition = tree["split_conditions"][node].as_float ();
+    const bool default_left = tree["default_left"][node].as_boolean ();
+
+    os << pad << "if (go_left (f[" << split_index << "], "
+        << float_literal (condition) << ", "
+        << (default_left ? "true" : "false") << "))" << endl;
+    os << pad << "{" << endl;
+    write_node (os, tree, left, indent + 1);
+    os << pad << "}" << endl;
+    os << pad << "else" << endl;
+    os << pad << "{" << endl;
+    write_node (os, tree, right, indent + 1);
+    os << pad << "}" << endl;
+}
+
+// Write the model as C++
+void write_model (ostream &os, const json::value &model, const string &model_filename)
+{
+    const auto &learner = model["learner"];
+    const auto &gradient_booster = learner["gradient_booster"];
+
+    if (gradient_booster["name"].as_string () != "gbtree")
+        throw runtime_error ("Only gbtree models are supported, not " + gradient_booster["name"].as_string ());
+
+    const auto &model_param = learner["learner_model_param"];
+    const size_t num_classes = std::max (size_t (1), size_t (model_param["num_class"].as_number ()));
+    const size_t num_features = model_param["num_feature"].as_number ();
+
+    // Use the same base score as the native engine
+    xgboost::tree_ensemble te (false);
+    te.load_model (model);
+    const auto &trees = gradient_booster["model"]["trees"];
+    const auto &tree_info = gradient_booster["model"]["tree_info"];
+
+    os << "// Generated by compile_model from " << model_filename << endl;
+    os << "//" << endl;
+    os << "// Do not edit this file, regenerate it from the model instead." << endl;
+    os << "#pragma once" << endl;
+    os << endl;
+    os << "#include \"coastnet.h\"" << endl;
+    os << endl;
+    os << "namespace ATL24_coastnet" << endl;
+    os << "{" << endl;
+    os << endl;
+    os << "namespace compiled_model" << endl;
+    os << "{" << endl;
+    os << endl;
+    os << "constexpr const char *model_filename = " << string_literal (model_filename) << ";" << endl;
+    os << "constexpr size_t num_classes = " << num_classes << ";" << endl;
+    os << "constexpr size_t num_features = " << num_features << ";" << endl;
+    os << "constexpr size_t num_trees = " << trees.size () << ";" << endl;
+    os << "constexpr float base_score[num_classes] = {" << endl;
+    for (size_t c = 0; c < num_classes; ++c)
+        os << "    " << float_literal (te.get_base_score (c)) << "," << endl;
+    os << "};" << endl;
+    const auto elevation_splits = xgboost::get_elevation_splits (model);
+    os << "constexpr float elevation_splits[] = {" << endl;
+    for (const auto s : elevation_splits)
+        os << "    " << float_literal (s) << "," << endl;
+    // An extra split at infinity keeps the array from being empty
+    os << "    std::numeric_limits<float>::infinity ()," << endl;
+    os << "};" << endl;
+    os << endl;
+    os << "// XGBoost sends missing values down the default branch" << endl;
+    os << "inline bool go_left (const float x, const float condition, const bool default_left)" << endl;
+    os << "{" << endl;
+    os << "    if (std::isnan (x) || x == xgboost::constants::missing_data)" << endl;
+    os << "        return default_left;" << endl;
+    os << "    return x < condition;" << endl;
+    os << "}" << endl;
+
+    // One function per tree
+    for (size_t i = 0; i < trees.size (); ++i)
+    {
+        os << endl;
+        os << "inline float tree_" << i << " (const float *f)" << endl;
+        os << "{" << endl;
+        write_node (os, trees[i], 0, 1);
+        os << "}" << endl;
+    }
+
+    // Accumulate in tree order, like libxgboost
+    os << endl;
+    os << "inline void add_trees (const float *f, float *margins)" << endl;
+    os << "{" << endl;
+    for (size_t i = 0; i < trees.size (); ++i)
+        os << "    margins[" << size_t (tree_info[i].as_number ()) << "] += tree_" << i << " (f);" << endl;
+    os << "}" << endl;
+
+    os << R"(
+// Predictor with the same interface as xgboost::xgbooster
+class predictor
+{
+    public:
+    std::vector<uint32_t> predict (const float *features,
+        const size_t rows,
+        const size_t cols) const
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (features != nullptr);
+        assert (rows != 0);
+
+        if (cols < num_features)
+            throw runtime_error ("Not enough features for the model");
+
+        vector<uint32_t> predictions (rows);
+        for (size_t i = 0; i < rows; ++i)
+        {
+            array<float, num_classes> margins;
+            copy (base_score, base_score + num_classes, margins.begin ());
+            add_trees (features + i * cols, &margins[0]);
+
+            // The prediction is the first class with the largest margin
+            predictions[i] = max_element (margins.begin (), margins.end ()) - margins.begin ();
+        }
+
+        return predictions;
+    }
+    std::vector<uint32_t> predict (const std::vector<float> &features,
+        const size_t rows,
+        const size_t cols) const
+    {
+        // Check invariants
+        assert (!features.empty ());
+        assert (features.size () == rows * cols);
+
+        return predict (&features[0], rows, cols);
+    }
+    // Features that are not stored are 0
+    std::vector<uint32_t> predict (const xgboost::sparse_features &features,
+        const size_t cols) const
+    {
+        // Check invariants
+        assert (features.rows () != 0);
+
+        return predict (xgboost::to_dense (features, cols), features.rows (), cols);
+    }
+    bool is_sparse () const
+    {
+        return true;
+    }
+    std::vector<float> get_elevation_splits () const
+    {
+        return std::vector<float> (std::begin (elevation_splits), std::end (elevation_splits));
+    }
+};
+
+} // namespace compiled_model
+
+// Classify points using the compiled model
+template<typename T>
+T classify (const bool verbose,
+    const T &p,
+    const compiled_model::predictor &cm,
+    const classify_params &cp = classify_params ())
+{
+    return detail::classify (verbose, p, cm, cp);
+}
+
+template<typename T>
+void classify_in_place (const bool verbose,
+    T &p,
+    const compiled_model::predictor &cm,
+    const classify_params &cp = classify_params ())
+{
+    detail::classify_in_place (verbose, p, cm, cp);
+}
+
+} // namespace ATL24_coastnet
+)";
+}
+
+int main (int argc, char **argv)
+{
+    try
+    {
+        // Parse the args
+        const auto args = cmd::get_args (argc, argv, usage);
+
+        // If you are getting help, exit without an error
+        if (args.help)
+            return 0;
+
+        if (args.verbose)
+        {
+            clog << "cmd_line_parameters:" << endl;
+            clog << args;
+        }
+
+        if (args.verbose)
+            clog << "Reading model from " << args.model_filename << endl;
+
+        const auto model = json::read (args.model_filename);
+
+        // Write to a temporary file first, so that a failed run doesn't
+        // leave a partial header behind
+        const string tmp_filename = args.output_filename + ".tmp";
+        {
+            ofstream ofs (tmp_filename);
+            if (!ofs)
+                throw runtime_error ("Could not open file for writing");
+
+            write_model (ofs, model, args.model_filename);
+
+            if (!ofs)
+                throw runtime_error ("Error writing generated model");
+        }
+        filesystem::rename (tmp_filename, args.output_filename);
+
+        if (args.verbose)
+            clog << "Wrote " << args.output_filename << endl;
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
@@ -59,8 +59,14 @@ unordered_map<long,confusion_matrix> get_confusion_matrix_map (
     const long cls,
     const long ignore_cls)
 {
-    // Read the points
-    const auto df = dataframe::read (is);
+    // Read the points, but only the columns that are scored
+    const auto df = dataframe::read (is,
+        { PI_NAME, X_NAME, Z_NAME, LABEL_NAME, PREDICTION_NAME },
+        {
+            { PI_NAME, columnar::column_type::int64 },
+            { LABEL_NAME, columnar::column_type::uint8 },
+            { PREDICTION_NAME, columnar::column_type::uint8 },
+        });
 
     if (verbose)
         clog << "Converting dataframe" << endl;
@@ -3,7 +3,12 @@
 #include "utils.h"
 #include "xgboost.h"
 
-const std::string usage {"ls *.csv | resnet [options]"};
+const std::string usage {"ls *.csv | resnet [options]\n"
+    "\n"
+    "\tTraining uses CUDA if libxgboost was built with it, and the CPU\n"
+    "\tif it wasn't. --cpu trains on the CPU from a QuantileDMatrix with\n"
+    "\tthe histogram method, using --threads threads. --threads also\n"
+    "\tlimits the threads used to read the files and build the patches."};
 
 int main (int argc, char **argv)
 {
@@ -98,6 +103,10 @@ int main (int argc, char **argv)
             clog << "Creating datasets" << endl;
         }
 
+        // When training from batches, the rasters are created as they
+        // are needed instead of all at once
+        const bool in_batches = !args.cache_prefix.empty ();
+
         // Create Datasets
         const size_t training_samples_per_class = 2'000'000;
         const size_t test_samples_per_class = 200'000;
@@ -109,7 +118,9 @@ int main (int argc, char **argv)
             enable_augmentation,
             training_samples_per_class,
             args.verbose,
-            rng);
+            rng,
+            !in_batches,
+            args.threads);
         auto test_dataset = coastnet_dataset (test_filenames,
             sampling_params::patch_rows,
             sampling_params::patch_cols,
@@ -118,7 +129,9 @@ int main (int argc, char **argv)
             false, // enable augmentation
             test_samples_per_class,
             false, // args.verbose,
-            rng);
+            rng,
+            !in_batches,
+            args.threads);
 
         if (args.verbose)
         {
@@ -185,25 +198,62 @@ int main (int argc, char **argv)
         // Create the booster
         xgboost::xgbooster xgb (args.verbose);
 
-        const size_t train_rows = train_features.size ();
         const size_t train_cols = FEATURES_PER_SAMPLE;
 
-        xgb.train (train_features.get_features (),
-            train_features.get_labels (),
-            train_rows,
-            train_cols,
-            args.epochs);
+        if (in_batches)
+        {
+            // Stream the features to XGBoost's external memory
+            xgb.train_in_batches ([&] (const size_t begin, const size_t end, float *f)
+                { train_features.get_features (begin, end, f); },
+                train_features.get_labels (),
+                train_cols,
+                args.cache_prefix,
+                args.batch_size,
+                args.epochs);
+        }
+        else if (args.cpu)
+        {
+            // Quantize the patches into histogram bins on the CPU
+            xgboost::hist_params hp;
+            hp.threads = args.threads;
+            hp.max_bin = args.max_bin;
+            xgb.train_hist (train_dataset.get_patch_features (),
+                train_features.get_labels (),
+                args.batch_size,
+                args.epochs,
+                hp);
+        }
+        else
+        {
+            // Hand the patches to XGBoost as they are, instead of
+            // expanding them into a float matrix
+            xgb.train (train_dataset.get_patch_features (),
+                train_features.get_labels (),
+                args.epochs);
+        }
 
         clog << "Saving model" << endl;
         xgb.save_model (args.model_filename);
 
         clog << "Testing model" << endl;
 
+        // Predict on the CPU
+        xgb.set_device (false);
+
+        // Predict one batch at a time
         const size_t test_rows = test_features.size ();
         const size_t test_cols = FEATURES_PER_SAMPLE;
-        const auto predictions = xgb.predict (test_features.get_features (),
-            test_rows,
-            test_cols);
+        vector<uint32_t> predictions;
+        predictions.reserve (test_rows);
+        vector<float> batch;
+        for (size_t begin = 0; begin < test_rows; begin += args.batch_size)
+        {
+            const size_t end = std::min (test_rows, begin + args.batch_size);
+            batch.resize ((end - begin) * test_cols);
+            test_features.get_features (begin, end, batch.data ());
+            const auto p = xgb.predict (batch, end - begin, test_cols);
+            predictions.insert (predictions.end (), p.begin (), p.end ());
+        }
 
         double total_correct = 0;
 
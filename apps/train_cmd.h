@@ -19,6 +19,11 @@ struct args
     size_t epochs = 20;
     size_t test_dataset = 0;
     size_t num_classes = 5;
+    std::string cache_prefix;
+    size_t batch_size = 1 << 16;
+    bool cpu = false;
+    size_t threads = 0;
+    size_t max_bin = 256;
 };
 
 std::ostream &operator<< (std::ostream &os, const args &args)
@@ -32,6 +37,11 @@ std::ostream &operator<< (std::ostream &os, const args &args)
     os << "epochs: " << args.epochs << std::endl;
     os << "test-dataset: " << args.test_dataset << std::endl;
     os << "num-classes: " << args.num_classes << std::endl;
+    os << "cache-prefix: " << args.cache_prefix << std::endl;
+    os << "batch-size: " << args.batch_size << std::endl;
+    os << "cpu: " << args.cpu << std::endl;
+    os << "threads: " << args.threads << std::endl;
+    os << "max-bin: " << args.max_bin << std::endl;
     return os;
 }
 
@@ -50,10 +60,15 @@ args get_args (int argc, char **argv, const std::string &usage)
             {"epochs", required_argument, 0,  'e' },
             {"test-dataset", required_argument, 0,  'd' },
             {"num-classes", required_argument, 0,  'c' },
+            {"cache-prefix", required_argument, 0,  'x' },
+            {"batch-size", required_argument, 0,  'b' },
+            {"cpu", no_argument, 0,  'u' },
+            {"threads", required_argument, 0,  'n' },
+            {"max-bin", required_argument, 0,  'm' },
             {0,      0,           0,  0 }
         };
 
-        int c = getopt_long(argc, argv, "hvs:f:t:e:d:c:", long_options, &option_index);
+        int c = getopt_long(argc, argv, "hvs:f:t:e:d:c:x:b:un:m:", long_options, &option_index);
         if (c == -1)
             break;
 
@@ -76,6 +91,11 @@ args get_args (int argc, char **argv, const std::string &usage)
             case 'e': args.epochs = atol(optarg); break;
             case 'd': args.test_dataset = atol(optarg); break;
             case 'c': args.num_classes = atol(optarg); break;
+            case 'x': args.cache_prefix = std::string(optarg); break;
+            case 'b': args.batch_size = atol(optarg); break;
+            case 'u': args.cpu = true; break;
+            case 'n': args.threads = atol(optarg); break;
+            case 'm': args.max_bin = atol(optarg); break;
         }
     }
 
@@ -88,6 +108,12 @@ args get_args (int argc, char **argv, const std::string &usage)
         throw std::runtime_error ("train-test-split must be >= 0.0");
     if (args.train_test_split > 0.5)
         throw std::runtime_error ("train-test-split must be <= 0.5");
+    if (args.batch_size == 0)
+        throw std::runtime_error ("batch-size must be > 0");
+    if (args.max_bin < 2)
+        throw std::runtime_error ("max-bin must be >= 2");
+    if (args.cpu && !args.cache_prefix.empty ())
+        throw std::runtime_error ("cpu and cache-prefix can't be used together");
 
     const size_t total_datasets = ((args.train_test_split == 0.0)
         ? 1
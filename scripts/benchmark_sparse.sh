@@ -0,0 +1,28 @@
+#!/usr/bin/bash
+
+# Compare dense and sparse feature throughput on real granules
+#
+# Usage: benchmark_sparse.sh "input/manual/*.csv" coastnet_model.json
+
+# Bash strict mode
+set -euo pipefail
+IFS=$'\n\t'
+
+input=$(ls -1 ${1} | head -n 10)
+model=${2}
+tmp=$(mktemp -d)
+trap 'rm -rf ${tmp}' EXIT
+
+for fn in ${input}
+do
+    echo ${fn}
+    for mode in dense sparse
+    do
+        opt=$([ ${mode} == sparse ] && echo "--sparse" || echo "")
+        build/release/classify --verbose ${opt} --num-classes=7 --model-filename=${model} \
+            < ${fn} > ${tmp}/${mode}.csv 2> ${tmp}/${mode}.log
+        echo -e "\t${mode}\t$(grep '^Classified' ${tmp}/${mode}.log)"
+    done
+    # The predictions must be identical
+    cmp ${tmp}/dense.csv ${tmp}/sparse.csv
+done
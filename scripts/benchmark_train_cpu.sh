@@ -0,0 +1,22 @@
+#!/usr/bin/bash
+
+# Report the CPU training time per boosting iteration
+#
+# Usage: benchmark_train_cpu.sh "input/manual/*.csv" [epochs]
+
+# Bash strict mode
+set -euo pipefail
+IFS=$'\n\t'
+
+input=${1}
+epochs=${2:-10}
+tmp=$(mktemp -d)
+trap 'rm -rf ${tmp}' EXIT
+
+for threads in 1 4 0
+do
+    ls -1 ${input} | build/release/train --verbose --cpu --threads=${threads} \
+        --num-classes=7 --epochs=${epochs} --model-filename=${tmp}/model.json \
+        > /dev/null 2> ${tmp}/train.log
+    echo -e "threads=${threads}\t$(grep '^Average time per iteration' ${tmp}/train.log)"
+done
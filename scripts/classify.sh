@@ -4,10 +4,15 @@
 set -euo pipefail
 IFS=$'\n\t'
 
+# Print the commands that classify each fold's test files, one process
+# per fold, so that each fold's model only gets loaded once. Pipe them
+# to 'parallel' to run them.
 mkdir -p predictions
 for n in $(seq 0 4)
 do
-    parallel --lb --dry-run \
-        "build/release/classify --verbose --num-classes=7 --model-filename=coastnet_model-${n}.json < {} > predictions/{/.}_classified_${n}.csv" \
-        :::: coastnet_test_files-${n}.txt
+    awk -v n=${n} '{ m = split($0, a, "/"); sub(/\.[^.]*$/, "", a[m]);
+        print $0 " predictions/" a[m] "_classified_" n ".csv" }' \
+        coastnet_test_files-${n}.txt > predictions/classify_files_${n}.txt
+    echo "build/release/classify --verbose --num-classes=7 --model-filename=coastnet_model-${n}.json" \
+        "--file-list=predictions/classify_files_${n}.txt"
 done
@@ -1,5 +1,7 @@
 #include "blunder_detection.h"
 #include "coastnet.h"
+#include "photons.h"
+#include "timer.h"
 #include "verify.h"
 
 using namespace std;
@@ -564,6 +566,422 @@ void test_filter_isolated_bathy ()
     }
 }
 
+// A random track with a surface at 0m and a bottom sloping down from -2m
+vector<classified_point2d> get_track (const size_t total, const unsigned seed)
+{
+    mt19937 rng (seed);
+    uniform_real_distribution<double> dx (0.0, 0.5);
+    normal_distribution<double> dz (0.0, 0.5);
+    uniform_real_distribution<double> noise (-30.0, 10.0);
+    discrete_distribution<unsigned> cls ({ 2, 5, 3 });
+
+    vector<classified_point2d> p (total);
+    double x = 1000.0;
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        x += dx (rng);
+        p[i].h5_index = i;
+        p[i].x = x;
+        switch (cls (rng))
+        {
+            case 0:
+            p[i].z = noise (rng);
+            p[i].prediction = 0;
+            break;
+            case 1:
+            p[i].z = dz (rng);
+            p[i].prediction = sea_surface_class;
+            break;
+            case 2:
+            p[i].z = -2.0 - (x - 1000.0) / 100.0 + dz (rng);
+            p[i].prediction = bathy_class;
+            break;
+        }
+    }
+    return p;
+}
+
+// Get estimates and run blunder detection
+template<typename T>
+T postprocess (T p)
+{
+    postprocess_params params;
+    const auto s = get_surface_estimates (p, params.surface_sigma);
+    const auto b = get_bathy_estimates (p, params.bathy_sigma);
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        p[i].surface_elevation = s[i];
+        p[i].bathy_elevation = b[i];
+    }
+    return blunder_detection (p, params);
+}
+
+void test_photon_columns ()
+{
+    auto p = get_track (5000, 123);
+
+    // Round trip
+    const photons q (p);
+    VERIFY (q.size () == p.size ());
+    VERIFY (q.to_points () == p);
+    VERIFY (count_predictions (q, bathy_class) == count_predictions (p, bathy_class));
+
+    // The algorithms should give the same answer with either layout
+    const auto r = postprocess (p);
+    VERIFY (count_predictions (r, bathy_class) != 0);
+    VERIFY (count_predictions (r, sea_surface_class) != 0);
+    VERIFY (postprocess (q).to_points () == r);
+
+    // Compact photons give the same answer when the elevations are
+    // already floats
+    for (auto &i : p)
+        i.z = float (i.z);
+    const compact_photons c (p);
+    VERIFY (c.to_points () == p);
+    const auto s = postprocess (p);
+    const auto t = postprocess (c);
+    for (size_t i = 0; i < s.size (); ++i)
+        VERIFY (t[i].prediction == s[i].prediction);
+
+    // Sorting moves whole photons
+    photons u (p);
+    shuffle (u.begin (), u.end (), mt19937 (456));
+    VERIFY (u.to_points () != p);
+    sort (u.begin (), u.end (), [](const auto &a, const auto &b) { return a.x < b.x; });
+    VERIFY (u.to_points () == p);
+}
+
+// Run the blunder detection stages one after the other
+template<typename T,typename U>
+T blunder_detection_by_stages (T p, const U &params)
+{
+    p = detail::surface_elevation_check (p, params.surface_min_elevation, params.surface_max_elevation);
+    p = detail::bathy_elevation_check (p, params.bathy_min_elevation);
+    p = detail::bathy_depth_check (p, params.blunder_surface_bin_size, params.blunder_surface_depth_factor);
+    p = detail::surface_range_check (p, params.surface_range);
+    p = detail::bathy_range_check (p, params.bathy_range);
+    p = detail::filter_isolated_bathy (p, params.isolated_bathy_radius, params.isolated_bathy_min_photons);
+    return p;
+}
+
+void test_blunder_detection_in_place ()
+{
+    mt19937 rng (789);
+    uniform_int_distribution<unsigned> label (0, 2);
+    normal_distribution<double> error (0.0, 2.0);
+
+    for (size_t k = 0; k < 20; ++k)
+    {
+        auto p = get_track (2000 + k * 100, k);
+
+        postprocess_params params;
+        const auto s = get_surface_estimates (p, params.surface_sigma);
+        const auto b = get_bathy_estimates (p, params.bathy_sigma);
+        for (size_t i = 0; i < p.size (); ++i)
+        {
+            p[i].surface_elevation = s[i];
+            p[i].bathy_elevation = b[i];
+        }
+
+        switch (k % 5)
+        {
+            // As is
+            case 0: break;
+            // Mislabeled photons
+            case 1:
+            for (auto &i : p)
+                if (label (rng) == 0)
+                    i.prediction = label (rng) == 0 ? 0 : (label (rng) == 1 ? sea_surface_class : bathy_class);
+            break;
+            // Noisy estimates
+            case 2:
+            for (auto &i : p)
+            {
+                i.surface_elevation += error (rng);
+                i.bathy_elevation += error (rng);
+            }
+            break;
+            // No surface
+            case 3:
+            for (auto &i : p)
+                if (i.prediction == sea_surface_class)
+                    i.prediction = 0;
+            break;
+            // No bathy
+            case 4:
+            for (auto &i : p)
+                if (i.prediction == bathy_class)
+                    i.prediction = 0;
+            break;
+        }
+
+        // Use small bins so that some bathy has no surface above it
+        params.blunder_surface_bin_size = k < 10 ? 30.0 : 2.0;
+
+        const auto q = blunder_detection_by_stages (p, params);
+        auto r (p);
+        blunder_detection_in_place (r, params);
+        VERIFY (r == q);
+        VERIFY (blunder_detection (p, params) == q);
+
+        // The compact photons should also match
+        for (auto &i : p)
+        {
+            i.z = float (i.z);
+            i.surface_elevation = float (i.surface_elevation);
+            i.bathy_elevation = float (i.bathy_elevation);
+        }
+        compact_photons c (p);
+        blunder_detection_in_place (c, params);
+        VERIFY (c == blunder_detection_by_stages (compact_photons (p), params));
+    }
+}
+
+// The original window scan, for comparison
+template<typename T>
+T filter_isolated_bathy_reference (T p,
+    const double isolated_bathy_radius,
+    const double isolated_bathy_min_photons)
+{
+    using namespace std;
+
+    assert (!p.empty ());
+
+    // Get indexes of bathy photons
+    vector<size_t> indexes;
+    for (size_t i = 0; i < p.size (); ++i)
+        if (p[i].prediction == bathy_class)
+            indexes.push_back (i);
+
+    // For each bathy photon, get left and right window indexes
+    vector<pair<size_t,size_t>> lr_indexes (indexes.size ());
+    for (size_t i = 0; i < lr_indexes.size (); ++i)
+    {
+        // Get left boundary
+        size_t j1 = i;
+        while (j1 > 0)
+        {
+
+            // Values should be sorted by XATC
+            assert (i < indexes.size ());
+            assert (j1 - 1 < indexes.size ());
+            assert (indexes[i] < p.size ());
+            assert (indexes[j1 - 1] < p.size ());
+            assert (p[indexes[j1 - 1]].x <= p[indexes[i]].x);
+
+            // Get the distance from 'i' to 'j' along X axis
+            const double dx = p[indexes[i]].x - p[indexes[j1 - 1]].x;
+
+            if (dx > isolated_bathy_radius)
+                break;
+
+            // Move left
+            --j1;
+        }
+
+        // Get right boundary
+        size_t j2 = i;
+        while (j2 + 1 < lr_indexes.size ())
+        {
+
+            // Values should be sorted by XATC
+            assert (i < indexes.size ());
+            assert (j2 + 1 < indexes.size ());
+            assert (indexes[i] < p.size ());
+            assert (indexes[j2 + 1] < p.size ());
+            assert (p[indexes[i]].x <= p[indexes[j2 + 1]].x);
+
+            // Get the distance from 'i' to 'j' along X axis
+            const double dx = p[indexes[j2 + 1]].x - p[indexes[i]].x;
+
+            if (dx > isolated_bathy_radius)
+                break;
+
+            // Move right
+            ++j2;
+        }
+
+        lr_indexes[i] = make_pair (j1, j2);
+    }
+
+    // For each bathy photon, count how many neighbors are within the radius
+    vector<size_t> neighbors (indexes.size ());
+    for (size_t i = 0; i < neighbors.size (); ++i)
+    {
+        // Get bounding indexes
+        assert (i < lr_indexes.size ());
+        size_t j1 = lr_indexes[i].first;
+        size_t j2 = lr_indexes[i].second;
+
+        // For each photon in the window
+        for (size_t j = j1; j <= j2; ++j)
+        {
+            assert (i < indexes.size ());
+            assert (j < indexes.size ());
+            assert (indexes[i] < p.size ());
+            assert (indexes[j] < p.size ());
+            const double dx = fabs (p[indexes[i]].x - p[indexes[j]].x);
+            const double dz = fabs (p[indexes[i]].z - p[indexes[j]].z);
+            const double d = std::sqrt (dx * dx + dz * dz);
+
+            // Count it
+            if (d < isolated_bathy_radius)
+                ++neighbors[i];
+        }
+
+        // Note that we always get a count of at least 1 because
+        // the photon at 'i' is 0.0 meters away
+        assert (neighbors[i] >= 1);
+    }
+
+    // Assume they are all isolated
+    for (size_t i = 0; i < indexes.size (); ++i)
+    {
+        assert (indexes[i] < p.size ());
+        p[indexes[i]].prediction = 0;
+    }
+
+    // Turn back on ones that are not isolated
+    for (size_t i = 0; i < indexes.size (); ++i)
+    {
+        if (neighbors[i] < isolated_bathy_min_photons)
+            continue;
+
+        // Get bounding indexes
+        assert (i < lr_indexes.size ());
+        size_t j1 = lr_indexes[i].first;
+        size_t j2 = lr_indexes[i].second;
+
+        // For each photon in the window
+        for (size_t j = j1; j <= j2; ++j)
+        {
+            const double dx = fabs (p[indexes[i]].x - p[indexes[j]].x);
+            const double dz = fabs (p[indexes[i]].z - p[indexes[j]].z);
+            const double d = std::sqrt (dx * dx + dz * dz);
+
+            // Is it close enough?
+            if (d > isolated_bathy_radius)
+                continue;
+
+            // Turn it back on
+            assert (j < indexes.size ());
+            assert (indexes[j] < p.size ());
+            p[indexes[j]].prediction = 40;
+        }
+    }
+
+    return p;
+}
+
+// Bathy photons along a sloping bottom, 'density' photons per meter
+vector<classified_point2d> get_dense_bathy (const size_t total, const double density, const unsigned seed)
+{
+    mt19937 rng (seed);
+    exponential_distribution<double> dx (density);
+    normal_distribution<double> dz (0.0, 0.5);
+    bernoulli_distribution stray (0.01);
+    uniform_real_distribution<double> dstray (-30.0, 0.0);
+
+    vector<classified_point2d> p (total);
+    double x = 1000.0;
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        x += dx (rng);
+        p[i].h5_index = i;
+        p[i].x = x;
+        p[i].z = stray (rng) ? dstray (rng) : -5.0 - (x - 1000.0) / 200.0 + dz (rng);
+        p[i].prediction = bathy_class;
+    }
+    return p;
+}
+
+void test_filter_isolated_bathy_grid ()
+{
+    // Random tracks
+    for (size_t k = 0; k < 20; ++k)
+    {
+        auto p = get_dense_bathy (1000, k < 10 ? 0.5 : 20.0, k);
+        const double r = (k % 5 + 1) * 0.7;
+        const double n = k % 4 + 1;
+        const auto q = filter_isolated_bathy_reference (p, r, n);
+        VERIFY (detail::filter_isolated_bathy (p, r, n) == q);
+    }
+
+    // Photons on a lattice are exactly one radius apart, and some are
+    // stacked
+    {
+        vector<classified_point2d> p;
+        for (size_t i = 0; i < 50; ++i)
+            for (size_t j = 0; j < 3; ++j)
+                p.push_back ({i, double (i / 2), -double (j * (i % 3)), 0, 40});
+        for (auto r : {0.5, 1.0, 2.0})
+            for (auto n : {2.0, 3.0, 5.0, 7.0})
+                VERIFY (detail::filter_isolated_bathy (p, r, n) == filter_isolated_bathy_reference (p, r, n));
+    }
+}
+
+void benchmark_filter_isolated_bathy ()
+{
+    const double r = 10.0;
+    const double n = 3;
+
+    for (auto density : {10.0, 100.0})
+    {
+        const auto p = get_dense_bathy (100000, density, 123);
+
+        timer t;
+        const auto q = filter_isolated_bathy_reference (p, r, n);
+        t.stop ();
+        const double ms1 = t.elapsed_ms ();
+
+        t.start ();
+        const auto s = detail::filter_isolated_bathy (p, r, n);
+        t.stop ();
+        const double ms2 = t.elapsed_ms ();
+
+        VERIFY (q == s);
+
+        clog << "filter_isolated_bathy, " << p.size () << " photons at " << density << " per meter:"
+            << " window " << ms1 << "ms, grid " << ms2 << "ms" << endl;
+    }
+}
+
+void test_set_elevation_estimates ()
+{
+    for (size_t k = 0; k < 6; ++k)
+    {
+        // Sparse tracks have gaps to fill in
+        auto p = get_track (k < 3 ? 20000 : 500, k);
+        if (k % 3 == 1)
+            for (auto &i : p)
+                if (i.prediction == bathy_class)
+                    i.prediction = 0;
+
+        const auto s = get_surface_estimates (p, 100.0);
+        const auto b = get_bathy_estimates (p, 60.0);
+
+        // The fused estimator should give exactly the same estimates
+        for (auto parallel : {false, true})
+        {
+            auto q (p);
+            set_elevation_estimates (q, 100.0, 60.0, parallel);
+            for (size_t i = 0; i < q.size (); ++i)
+            {
+                VERIFY (q[i].surface_elevation == s[i]);
+                VERIFY (q[i].bathy_elevation == b[i]);
+            }
+        }
+
+        photons r (p);
+        set_elevation_estimates (r, 100.0, 60.0);
+        for (size_t i = 0; i < r.size (); ++i)
+        {
+            VERIFY (r[i].surface_elevation == s[i]);
+            VERIFY (r[i].bathy_elevation == b[i]);
+        }
+    }
+}
+
 int main ()
 {
     try
@@ -581,6 +999,11 @@ int main ()
         test_no_bathy ();
         test_bathy_depth_check ();
         test_filter_isolated_bathy ();
+        test_photon_columns ();
+        test_set_elevation_estimates ();
+        test_blunder_detection_in_place ();
+        test_filter_isolated_bathy_grid ();
+        benchmark_filter_isolated_bathy ();
 
         return 0;
     }
@@ -1,4 +1,5 @@
 #include "coastnet.h"
+#include "photons.h"
 #include "verify.h"
 
 using namespace std;
@@ -39,12 +40,106 @@ void test_classify ()
         const auto tmp = classify (verbose, p, fn);
         VERIFY (tmp == q);
     }
+
+    // The parallel path should give the same answer as the serial path
+    for (auto threads : {0, 2, 4})
+    {
+        classify_params cp;
+        cp.threads = threads;
+        const auto tmp = classify (verbose, p, fn, cp);
+        VERIFY (tmp == q);
+    }
+
+    // The sparse features should give the same answer as the dense features
+    {
+        classify_params cp;
+        cp.sparse = true;
+        const auto tmp = classify (verbose, p, fn, cp);
+        VERIFY (tmp == q);
+    }
+
+    // So should the struct-of-arrays photons
+    {
+        const auto tmp = classify (verbose, photons (p), fn);
+        VERIFY (tmp.to_points () == q);
+    }
+
+    // Classifying in place through a span should give the same answer,
+    // and leave the points in their original order
+    {
+        xgboost::tree_ensemble te (verbose);
+        te.load_model (fn);
+        const auto c = classify (verbose, p, te);
+
+        auto tmp = p;
+        span<classified_point2d> s (tmp);
+        classify_in_place (verbose, s, te);
+        VERIFY (tmp == c);
+
+        // Including points that are already sorted
+        auto sorted = p;
+        sort (sorted.begin (), sorted.end (), [] (const auto &a, const auto &b) { return a.x < b.x; });
+        VERIFY (ordering::get_x_order (sorted).empty ());
+        const auto d = classify (verbose, sorted, te);
+        photons r (sorted);
+        classify_in_place (verbose, r, te);
+        VERIFY (r.to_points () == d);
+    }
+}
+
+void test_patch_builder ()
+{
+    // Random points, some of them stacked at the same X
+    mt19937 rng(12345);
+    const size_t total = 5000;
+
+    uniform_real_distribution<double> dx (0.0, 0.5);
+    uniform_real_distribution<double> dz (-40.0, 20.0);
+    bernoulli_distribution stacked (0.1);
+
+    vector<classified_point2d> p (total);
+    double x = 100.0;
+
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        if (!stacked (rng))
+            x += dx (rng);
+        p[i].h5_index = i;
+        p[i].x = x;
+        p[i].z = dz (rng);
+    }
+
+    const size_t rows = sampling_params::patch_rows;
+    const size_t cols = sampling_params::patch_cols;
+    const double aspect_ratio = sampling_params::aspect_ratio;
+    augmentation_params ap;
+
+    // Visit the points in order
+    patch_builder pb (p, rows, cols, aspect_ratio);
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        const auto r1 = create_raster (p, i, rows, cols, aspect_ratio);
+        const auto r2 = pb.create_raster (i);
+        VERIFY (r1 == r2);
+    }
+
+    // Visit them with gaps and jumps backwards, with augmentation
+    patch_builder pb2 (p, rows, cols, aspect_ratio);
+    uniform_int_distribution<size_t> di (0, p.size () - 1);
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        const size_t index = di (rng);
+        const auto r1 = create_raster (p, index, rows, cols, aspect_ratio, ap, true, i);
+        const auto r2 = pb2.create_raster (index, ap, true, i);
+        VERIFY (r1 == r2);
+    }
 }
 
 int main ()
 {
     try
     {
+        test_patch_builder ();
         test_classify ();
 
         return 0;
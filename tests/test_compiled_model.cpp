@@ -0,0 +1,51 @@
+#include "compiled_model.h"
+#include "tree_ensemble.h"
+#include "verify.h"
+#include "test_utils.h"
+
+using namespace std;
+using namespace ATL24_coastnet;
+
+void test_compiled_model ()
+{
+    // Get a reference set of patches
+    const auto p = get_points (10000, 123);
+    const size_t rows = p.size ();
+    const size_t cols = FEATURES_PER_SAMPLE;
+    vector<float> f;
+    create_features (p, 0, rows, f);
+
+    // Compare against the model that was compiled
+    xgboost::xgbooster xgb (false);
+    xgb.load_model (compiled_model::model_filename);
+    xgboost::tree_ensemble te (false);
+    te.load_model (string (compiled_model::model_filename));
+
+    compiled_model::predictor cm;
+    const auto q = cm.predict (f, rows, cols);
+    VERIFY (q == xgb.predict (f, rows, cols));
+    VERIFY (q == te.predict (f, rows, cols));
+
+    // Sparse features should give the same answer
+    xgboost::sparse_features sf;
+    create_features (p, 0, rows, sf);
+    VERIFY (cm.predict (sf, cols) == q);
+
+    // So should the classifications
+    VERIFY (classify (false, p, cm) == classify (false, p, xgb));
+}
+
+int main ()
+{
+    try
+    {
+        test_compiled_model ();
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
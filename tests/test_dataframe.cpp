@@ -1,39 +1,12 @@
 #include "dataframe.h"
+#include "photons.h"
+#include "utils.h"
+#include "timer.h"
 #include "verify.h"
 
 using namespace std;
 using namespace ATL24_coastnet::dataframe;
-using namespace std::chrono;
-
-class timer
-{
-private:
-    time_point<system_clock> t1;
-    time_point<system_clock> t2;
-    bool running;
-
-public:
-    timer () : running (false)
-    {
-        start ();
-    }
-    void start ()
-    {
-        t1 = system_clock::now ();
-        running = true;
-    }
-    void stop ()
-    {
-        t2 = system_clock::now ();
-        running = false;
-    }
-    double elapsed_ms()
-    {
-        return running
-            ? duration_cast<milliseconds> (system_clock::now () - t1).count ()
-            : duration_cast<milliseconds> (t2 - t1).count ();
-    }
-};
+using ATL24_coastnet::timer;
 
 struct temp_file
 {
@@ -117,6 +90,500 @@ void test_read (const size_t cols, const size_t rows)
     VERIFY (df == tmp);
 }
 
+// Compare dataframes bit by bit, so that NaN's compare equal
+bool same_bits (const dataframe &a, const dataframe &b)
+{
+    if (a.get_headers () != b.get_headers () || a.rows () != b.rows ())
+        return false;
+    for (size_t j = 0; j < a.cols (); ++j)
+    {
+        for (size_t i = 0; i < a.rows (); ++i)
+        {
+            const double x = a.get_value (j, i);
+            const double y = b.get_value (j, i);
+            if (memcmp (&x, &y, sizeof (double)) != 0)
+                return false;
+        }
+    }
+    return true;
+}
+
+void test_read_semantics ()
+{
+    // Odd input should be read the same way by both readers
+    const vector<string> inputs {
+        "",
+        "a,b,c",
+        "a,b,c\n",
+        "a,b,c\r\n1,2,3\r\n4,5,6\r\n",
+        "a,b,c\n1,2,3\n\n\n4,5,6",
+        "a,b,c\n1,2\n1,2,3,4\n,,\n1,,3\n",
+        "a,b,c\n+1, 2,\t3\n0x10,1e400,-1e-400\n",
+        "a,b,c\nnan,inf,-infinity\nabc,1,2\n1.5abc,2,3\n",
+        "a,b,\n1,2,3\n\r\n",
+        "x\n-0\n.5\n-.5\n5.\n1e5\n1E+05\n123456789012345678901234567890\n",
+    };
+
+    for (const auto &s : inputs)
+    {
+        stringstream ss1 (s);
+        stringstream ss2 (s);
+        const auto df1 = read_by_line (ss1);
+        const auto df2 = read (ss2);
+        VERIFY (same_bits (df1, df2));
+
+        // Try every chunk size
+        for (size_t chunk_size = 1; chunk_size <= s.size () + 1; ++chunk_size)
+        {
+            VERIFY (same_bits (df1, detail::parse (s.data (), s.data () + s.size (), chunk_size)));
+            VERIFY (same_bits (df1, detail::parse (s.data (), s.data () + s.size (), chunk_size, { }, { }, 1)));
+        }
+    }
+}
+
+void test_read_pipe ()
+{
+    namespace columnar = ATL24_coastnet::columnar;
+
+    const auto df = get_random_dataframe (5, 1001);
+    stringstream csv;
+    write (csv, df);
+    stringstream col;
+    write_columnar (col, df);
+
+    // Pipes can't be mapped, so they get read like a stream, and
+    // checking for a columnar header must not lose it
+    for (const auto &s : {csv.str (), col.str ()})
+    {
+        temp_file tf;
+        VERIFY (::mkfifo (tf.name.c_str (), 0600) == 0);
+        VERIFY (!ATL24_coastnet::is_regular_file (tf.name));
+        VERIFY (!columnar::is_columnar (tf.name));
+
+        dataframe d;
+#pragma omp parallel sections num_threads(2)
+        {
+#pragma omp section
+            {
+                ofstream ofs (tf.name, ios::binary);
+                ofs.write (s.data (), s.size ());
+            }
+#pragma omp section
+            d = read (tf.name);
+        }
+        VERIFY (d == df);
+    }
+}
+
+void benchmark_read (const size_t cols, const size_t rows)
+{
+    const auto df = get_random_dataframe (cols, rows);
+
+    temp_file tf;
+    write (tf.name, df);
+    const double mb = filesystem::file_size (tf.name) / 1e6;
+
+    timer t;
+    ifstream ifs (tf.name);
+    const auto df1 = read_by_line (ifs);
+    t.stop ();
+    const double ms1 = t.elapsed_ms ();
+
+    t.start ();
+    const auto df2 = read (tf.name);
+    t.stop ();
+    const double ms2 = t.elapsed_ms ();
+
+    VERIFY (df1 == df);
+    VERIFY (df2 == df);
+
+    clog << "Read " << mb << "MB:"
+        << " by line " << ms1 << "ms (" << mb * 1000.0 / ms1 << "MB/s),"
+        << " mapped " << ms2 << "ms (" << mb * 1000.0 / ms2 << "MB/s)" << endl;
+}
+
+void test_write_format ()
+{
+    // Odd values
+    dataframe df;
+    df.add_column ("a", { 0.0, -0.0, -0.00004, 0.00005, 1e300, -1e-300, NAN, -NAN, INFINITY, -INFINITY, 123456789.123456789 });
+    df.add_column ("b", vector<double> (df.rows (), 2.5));
+
+    for (auto precision : {0, 1, 4, 16, 40})
+    {
+        // The output should match iostream formatting
+        stringstream expected;
+        expected << "a,b\n" << fixed << setprecision (precision);
+        for (size_t i = 0; i < df.rows (); ++i)
+            expected << df.get_value (0, i) << "," << df.get_value (1, i) << "\n";
+
+        stringstream ss;
+        write (ss, df, precision);
+        VERIFY (ss.str () == expected.str ());
+    }
+}
+
+void test_columnar ()
+{
+    namespace columnar = ATL24_coastnet::columnar;
+    using ATL24_coastnet::LABEL_NAME;
+    using ATL24_coastnet::SEA_SURFACE_NAME;
+    using ATL24_coastnet::BATHY_NAME;
+
+    const auto df = get_random_dataframe (5, 1001);
+
+    // Round trip through a stream
+    stringstream ss;
+    write_columnar (ss, df);
+    VERIFY (read (ss) == df);
+
+    // Round trip through a file
+    temp_file tf;
+    write_columnar (tf.name, df);
+    VERIFY (columnar::is_columnar (tf.name));
+    VERIFY (read (tf.name) == df);
+
+    // The columns are used in place
+    const columnar::table t (tf.name);
+    VERIFY (t.rows () == df.rows ());
+    VERIFY (t.get_headers () == df.get_headers ());
+    for (size_t j = 0; j < t.cols (); ++j)
+    {
+        const auto c = t.get_column<double> (j);
+        VERIFY (reinterpret_cast<uintptr_t> (c.data ()) % columnar::alignment == 0);
+        for (size_t i = 0; i < t.rows (); ++i)
+            VERIFY (c[i] == df.get_value (j, i));
+    }
+
+    // Mixed types, the columns are written in place
+    const vector<int64_t> a_values { -1, 0, int64_t (1) << 40 };
+    const vector<float> b_values { 0.5f, -1.25f, 3.0f };
+    const vector<uint8_t> c_values { 0, 40, 255 };
+    const vector<int32_t> d_values { 7, -8, 9 };
+    columnar::writer w (3);
+    w.add_column ("a", a_values);
+    w.add_column ("b", b_values);
+    w.add_column ("c", c_values);
+    w.add_column ("d", d_values);
+    stringstream ss2;
+    w.write (ss2);
+
+    // Converted columns are the same, no matter how many rows get
+    // buffered at a time
+    for (size_t buffer_rows : {1, 2, 3, 1000})
+    {
+        columnar::writer w2 (3, buffer_rows);
+        w2.add_column<int64_t> ("a", [&] (const size_t i) { return double (a_values[i]); });
+        w2.add_column<float> ("b", [&] (const size_t i) { return b_values[i]; });
+        w2.add_column<uint8_t> ("c", [&] (const size_t i) { return int (c_values[i]); });
+        w2.add_column ("d", d_values);
+        stringstream ss3;
+        w2.write (ss3);
+        VERIFY (ss3.str () == ss2.str ());
+    }
+
+    const string s = ss2.str ();
+    const columnar::table t2 (vector<char> (s.begin (), s.end ()));
+    VERIFY (t2.get_type ("b") == columnar::column_type::float32);
+    VERIFY (t2.get_column<int64_t> ("a")[2] == int64_t (1) << 40);
+    VERIFY (t2.get_column<uint8_t> ("c")[2] == 255);
+    VERIFY (t2.get_value ("b", 1) == -1.25);
+    VERIFY (t2.get_value ("d", 1) == -8.0);
+
+    // Asking for the wrong type is an error
+    bool thrown = false;
+    try { t2.get_column<double> ("a"); }
+    catch (const runtime_error &) { thrown = true; }
+    VERIFY (thrown);
+
+    // So is a truncated file. The last block holds 12 bytes of values
+    // and 52 bytes of padding.
+    for (auto n : { size_t (4), size_t (20), size_t (64), s.size () - 53 })
+    {
+        thrown = false;
+        try { columnar::table (vector<char> (s.begin (), s.begin () + n)); }
+        catch (const runtime_error &) { thrown = true; }
+        VERIFY (thrown);
+    }
+    columnar::table (vector<char> (s.begin (), s.end () - 52));
+
+    // Photons convert the same way from CSV and columnar tables. The
+    // values are exact at the precision of the CSV output.
+    vector<ATL24_coastnet::classified_point2d> p (100);
+    for (size_t i = 0; i < p.size (); ++i)
+        p[i] = { i, i * 0.25, -1.0 * i, i % 3, i % 5, 2.5, -3.5 };
+    stringstream csv;
+    stringstream bin;
+    write_classified_point2d (csv, p);
+    write_classified_point2d_columnar (bin, p);
+    const auto q = ATL24_coastnet::convert_dataframe (read (csv));
+    const string b = bin.str ();
+    VERIFY (ATL24_coastnet::convert_dataframe (columnar::table (vector<char> (b.begin (), b.end ()))) == q);
+    VERIFY (ATL24_coastnet::convert_dataframe (read (bin)) == q);
+
+    // Photons write their columns in place, with the same result
+    stringstream bin2;
+    write_classified_point2d_columnar (bin2, ATL24_coastnet::photons (p));
+    VERIFY (bin2.str () == b);
+}
+
+void benchmark_columnar (const size_t cols, const size_t rows)
+{
+    const auto df = get_random_dataframe (cols, rows);
+
+    temp_file csv;
+    temp_file bin;
+    write (csv.name, df);
+    write_columnar (bin.name, df);
+
+    timer t;
+    const auto df1 = read (csv.name);
+    t.stop ();
+    const double ms1 = t.elapsed_ms ();
+
+    t.start ();
+    const ATL24_coastnet::columnar::table tbl (bin.name);
+    double sum = 0.0;
+    for (size_t j = 0; j < tbl.cols (); ++j)
+        for (auto x : tbl.get_column<double> (j))
+            sum += x;
+    t.stop ();
+    const double ms2 = t.elapsed_ms ();
+    VERIFY (sum > 0.0);
+
+    clog << "Read " << rows << " rows:"
+        << " CSV " << ms1 << "ms,"
+        << " columnar " << ms2 << "ms" << endl;
+}
+
+// Get some of the columns of a dataframe
+dataframe get_columns (const dataframe &df, const vector<string> &names)
+{
+    dataframe tmp;
+    for (const auto &h : df.get_headers ())
+        if (find (names.begin (), names.end (), h) != names.end ())
+            tmp.add_column (h, vector<double> (df.get_column (h).begin (), df.get_column (h).end ()));
+    return tmp;
+}
+
+void test_read_columns (const size_t cols, const size_t rows)
+{
+    const auto df = get_random_dataframe (cols, rows);
+    const auto headers = df.get_headers ();
+
+    stringstream csv;
+    stringstream bin;
+    write (csv, df);
+    write_columnar (bin, df);
+    const string s = csv.str ();
+    const string b = bin.str ();
+
+    // Out of order, and with a column that isn't there
+    const vector<vector<string>> selections {
+        { },
+        { headers[0] },
+        { headers[cols - 1] },
+        { headers[3], headers[1], "missing" },
+        { "missing" },
+    };
+
+    for (const auto &names : selections)
+    {
+        const auto expected = names.empty () ? df : get_columns (df, names);
+
+        stringstream ss1 (s);
+        stringstream ss2 (b);
+        VERIFY (read (ss1, names) == expected);
+        VERIFY (read (ss2, names) == expected);
+
+        // Try some chunk sizes
+        for (size_t chunk_size : { 1, 7, 100, 1 << 22 })
+            VERIFY (detail::parse (s.data (), s.data () + s.size (), chunk_size, names) == expected);
+    }
+}
+
+void benchmark_read_columns (const size_t cols, const size_t rows)
+{
+    const auto df = get_random_dataframe (cols, rows);
+    const auto headers = df.get_headers ();
+
+    temp_file tf;
+    write (tf.name, df);
+
+    timer t;
+    const auto df1 = read (tf.name);
+    t.stop ();
+    const double ms1 = t.elapsed_ms ();
+
+    const vector<string> names (headers.begin (), headers.begin () + 4);
+    t.start ();
+    const auto df2 = read (tf.name, names);
+    t.stop ();
+    const double ms2 = t.elapsed_ms ();
+
+    VERIFY (df2 == get_columns (df1, names));
+
+    clog << "Read " << rows << " rows:"
+        << " all " << cols << " columns " << ms1 << "ms,"
+        << " " << names.size () << " columns " << ms2 << "ms" << endl;
+}
+
+// Convert one value at a time, by name
+template<typename T>
+vector<ATL24_coastnet::classified_point2d> convert_by_name (const T &df)
+{
+    using namespace ATL24_coastnet;
+
+    vector<classified_point2d> p (df.rows ());
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        p[i].h5_index = df.get_value (PI_NAME, i);
+        p[i].x = df.get_value (X_NAME, i);
+        p[i].z = df.get_value (Z_NAME, i);
+        p[i].cls = df.get_value (LABEL_NAME, i);
+        p[i].prediction = df.get_value (PREDICTION_NAME, i);
+        p[i].surface_elevation = df.get_value (SEA_SURFACE_NAME, i);
+        p[i].bathy_elevation = df.get_value (BATHY_NAME, i);
+    }
+    return p;
+}
+
+void test_convert_dataframe (const size_t rows)
+{
+    namespace columnar = ATL24_coastnet::columnar;
+    using ATL24_coastnet::LABEL_NAME;
+    using ATL24_coastnet::SEA_SURFACE_NAME;
+    using ATL24_coastnet::BATHY_NAME;
+
+    // Photons with an extra column that is not used
+    dataframe df;
+    uniform_real_distribution<double> d (-100.0, 100.0);
+    const vector<string> names { "lat_ph", PI_NAME, X_NAME, Z_NAME, LABEL_NAME, PREDICTION_NAME, SEA_SURFACE_NAME, BATHY_NAME };
+    for (const auto &name : names)
+    {
+        vector<double> values (rows);
+        for (size_t i = 0; i < rows; ++i)
+            values[i] = (name == PI_NAME || name == LABEL_NAME || name == PREDICTION_NAME) ? rng () % 64 : d (rng);
+        df.add_column (name, values);
+    }
+
+    VERIFY (df.get_column (X_NAME).size () == rows);
+    VERIFY (df.get_column (X_NAME)[rows / 2] == df.get_value (X_NAME, rows / 2));
+
+    timer t;
+    const auto p = convert_by_name (df);
+    t.stop ();
+    const double ms1 = t.elapsed_ms ();
+
+    t.start ();
+    const auto q = ATL24_coastnet::convert_dataframe (df);
+    t.stop ();
+    const double ms2 = t.elapsed_ms ();
+
+    VERIFY (p == q);
+
+    // The thread count doesn't change the results
+    bool has_manual_label;
+    bool has_predictions;
+    VERIFY (ATL24_coastnet::convert_dataframe (df, has_manual_label, has_predictions, 1) == p);
+    VERIFY (has_manual_label && has_predictions);
+
+    // So do photons that are converted without a vector of points
+    VERIFY (ATL24_coastnet::convert_dataframe_to_photons (df, has_manual_label, has_predictions, 1) == ATL24_coastnet::photons (p));
+
+    // Columnar tables convert from their stored types
+    stringstream ss;
+    write_columnar (ss, df);
+    const string s = ss.str ();
+    const columnar::table tbl (vector<char> (s.begin (), s.end ()));
+    VERIFY (convert_by_name (tbl) == p);
+    VERIFY (ATL24_coastnet::convert_dataframe (tbl) == p);
+
+    clog << "Convert " << rows << " rows:"
+        << " by name " << ms1 << "ms,"
+        << " by column " << ms2 << "ms" << endl;
+}
+
+template<typename F>
+bool throws (const F &f)
+{
+    try { f (); }
+    catch (const runtime_error &) { return true; }
+    return false;
+}
+
+void test_typed_columns ()
+{
+    using ATL24_coastnet::columnar::column_type;
+
+    const string s = "a,b,c,d,e\n"
+        "9007199254740993,40.0000,-7,1.5,2.25\n"
+        "-9223372036854775808,255,2147483647,-1e10,nan\n";
+    const column_types types {
+        { "a", column_type::int64 },
+        { "b", column_type::uint8 },
+        { "c", column_type::int32 },
+        { "d", column_type::float32 },
+    };
+
+    // Declared types
+    stringstream ss (s);
+    const auto df = read (ss, { }, types);
+    VERIFY (df.get_type ("a") == column_type::int64);
+    VERIFY (df.get_type ("e") == column_type::float64);
+    VERIFY (df.get_column<int64_t> ("a")[0] == 9007199254740993);
+    VERIFY (df.get_column<int64_t> ("a")[1] == numeric_limits<int64_t>::min ());
+    VERIFY (df.get_column<uint8_t> ("b")[0] == 40);
+    VERIFY (df.get_column<uint8_t> ("b")[1] == 255);
+    VERIFY (df.get_column<int32_t> ("c")[0] == -7);
+    VERIFY (df.get_column<float> ("d")[1] == -1e10f);
+    VERIFY (df.get_value ("d", 0) == 1.5);
+    VERIFY (throws ([&] { df.get_column<double> ("a"); }));
+
+    // Every parallel chunking gives the same result
+    for (size_t chunk_size = 1; chunk_size <= s.size (); ++chunk_size)
+        VERIFY (same_bits (detail::parse (s.data (), s.data () + s.size (), chunk_size, { }, types), df));
+
+    // Integers are written as integers, and columnar tables keep their types
+    stringstream out;
+    write (out, df, 2);
+    VERIFY (out.str () == "a,b,c,d,e\n"
+        "9007199254740993,40,-7,1.50,2.25\n"
+        "-9223372036854775808,255,2147483647,-10000000000.00,nan\n");
+    stringstream bin;
+    write_columnar (bin, df);
+    const auto tmp = read (bin);
+    VERIFY (tmp.get_type ("b") == column_type::uint8);
+    VERIFY (tmp.get_column<int64_t> ("a")[0] == 9007199254740993);
+
+    // Values that don't fit are errors
+    for (const auto &t : { "b\n256\n", "b\n-1\n", "b\n1.5\n", "b\nnan\n", "c\n2147483648\n" })
+    {
+        stringstream ss2 (t);
+        VERIFY (throws ([&] { read (ss2, { }, { { "b", column_type::uint8 }, { "c", column_type::int32 } }); }));
+    }
+    stringstream bin2;
+    write_columnar (bin2, df);
+    VERIFY (throws ([&] { read (bin2, { }, { { "c", column_type::uint8 } }); }));
+
+    // Infer the smallest integer types
+    dataframe df2;
+    df2.add_column ("a", { 0.0, 255.0 });
+    df2.add_column ("b", { -1.0, 255.0 });
+    df2.add_column ("c", { 0.0, 1e10 });
+    df2.add_column ("d", { 0.5, 1.0 });
+    df2.add_column ("e", { -0.0, 1.0 });
+    df2.add_column ("f", { NAN, 1.0 });
+    infer_types (df2);
+    VERIFY (df2.get_type ("a") == column_type::uint8);
+    VERIFY (df2.get_type ("b") == column_type::int32);
+    VERIFY (df2.get_type ("c") == column_type::int64);
+    VERIFY (df2.get_type ("d") == column_type::float64);
+    VERIFY (df2.get_type ("e") == column_type::float64);
+    VERIFY (df2.get_type ("f") == column_type::float64);
+    VERIFY (df2.get_value ("c", 1) == 1e10);
+}
+
 int main ()
 {
     try
@@ -127,6 +594,16 @@ int main ()
         test_dataframe (10, 100, 16);
         test_dataframe (100, 1, 16);
         test_write (10, 100'000);
+        test_read_semantics ();
+        test_read_pipe ();
+        test_write_format ();
+        benchmark_read (10, 300'000);
+        test_columnar ();
+        benchmark_columnar (10, 300'000);
+        test_convert_dataframe (1'000'000);
+        test_read_columns (10, 1000);
+        benchmark_read_columns (20, 300'000);
+        test_typed_columns ();
 
         return 0;
     }
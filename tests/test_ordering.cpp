@@ -0,0 +1,178 @@
+#include "ordering.h"
+#include "photons.h"
+#include "timer.h"
+#include "utils.h"
+#include "verify.h"
+
+using namespace std;
+using namespace ATL24_coastnet;
+using ATL24_coastnet::timer;
+
+// Does get_order () give the same order as a stable sort?
+bool is_stable_order (const vector<double> &x, const size_t threads = 0)
+{
+    ordering::ordering_params params;
+    params.threads = threads;
+    const auto order = ordering::get_order (x.size (), [&] (const size_t i) { return x[i]; }, params);
+    if (order.empty ())
+        return is_sorted (x.begin (), x.end ());
+
+    vector<size_t> expected (x.size ());
+    iota (expected.begin (), expected.end (), 0);
+    stable_sort (expected.begin (), expected.end (),
+        [&](const auto &a, const auto &b)
+        { return x[a] < x[b]; });
+    return order == expected;
+}
+
+// Nearly sorted values, like photons along a track
+//
+// 'swaps' nearby pairs are out of order, and some values repeat.
+vector<double> get_track (const size_t total, const size_t swaps, const unsigned seed)
+{
+    mt19937 rng (seed);
+    uniform_real_distribution<double> dx (0.0, 0.5);
+    bernoulli_distribution stacked (0.05);
+
+    vector<double> x (total);
+    double last = 100.0;
+    for (auto &i : x)
+    {
+        if (!stacked (rng))
+            last += dx (rng);
+        i = last;
+    }
+
+    uniform_int_distribution<size_t> di (0, total - 10);
+    uniform_int_distribution<size_t> dj (1, 9);
+    for (size_t i = 0; i < swaps; ++i)
+    {
+        const size_t j = di (rng);
+        swap (x[j], x[j + dj (rng)]);
+    }
+
+    return x;
+}
+
+void test_radix_key ()
+{
+    const vector<double> x { -1e300, -2.5, -1.0, -1e-300, 0.0, 1e-300, 1.0, 2.5, 1e300 };
+    for (size_t i = 0; i + 1 < x.size (); ++i)
+        VERIFY (ordering::get_radix_key (x[i]) < ordering::get_radix_key (x[i + 1]));
+    VERIFY (ordering::get_radix_key (-0.0) == ordering::get_radix_key (0.0));
+}
+
+void test_get_order ()
+{
+    auto get = [] (const vector<double> &x) { return ordering::get_order (x.size (), [&] (const size_t i) { return x[i]; }); };
+
+    // Empty and sorted input need no order
+    VERIFY (get (vector<double> ()).empty ());
+    VERIFY (get (vector<double> { 1.0 }).empty ());
+    VERIFY (get (get_track (1000, 0, 1)).empty ());
+    VERIFY (!get (vector<double> { 2.0, 1.0 }).empty ());
+
+    // Every path should match a stable sort: nearly sorted, shuffled
+    // too much for insertion sort, and shuffled
+    for (auto swaps : {1, 10, 100, 10000})
+    {
+        const auto x = get_track (10000, swaps, 2);
+        VERIFY (is_stable_order (x));
+    }
+    for (auto n : {2, 3, 100, 100000, 300000})
+    {
+        auto x = get_track (n, 0, 3);
+        shuffle (x.begin (), x.end (), mt19937 (4));
+        VERIFY (is_stable_order (x));
+
+        // The radix sort's blocks depend on the number of threads
+        VERIFY (is_stable_order (x, 1));
+        VERIFY (is_stable_order (x, 3));
+    }
+
+    // Negative values, and values that differ in every byte
+    {
+        mt19937 rng (5);
+        uniform_real_distribution<double> d (-1e6, 1e6);
+        vector<double> x (5000);
+        for (auto &i : x)
+            i = d (rng);
+        x[10] = x[20] = -0.0;
+        x[30] = 0.0;
+        VERIFY (is_stable_order (x));
+    }
+}
+
+void test_gather_scatter ()
+{
+    const auto x = get_track (1000, 50, 6);
+    vector<classified_point2d> p (x.size ());
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        p[i].h5_index = i;
+        p[i].x = x[i];
+    }
+
+    for (auto q : {p, vector<classified_point2d> (p.rbegin (), p.rend ())})
+    {
+        const auto order = ordering::get_x_order (q);
+        VERIFY (order.size () == q.size ());
+
+        // Gathering should sort the points
+        photons r (q);
+        ordering::gather_in_place (r, order);
+        for (size_t i = 0; i < r.size (); ++i)
+            VERIFY (r[i].h5_index == q[order[i]].h5_index);
+        VERIFY (ordering::get_x_order (r).empty ());
+
+        // And scattering should put them back
+        ordering::scatter_in_place (r, order);
+        VERIFY (r.to_points () == q);
+    }
+}
+
+void benchmark_get_order ()
+{
+    const size_t total = 5000000;
+
+    for (auto swaps : {size_t (0), size_t (1000), total})
+    {
+        const auto x = get_track (total, swaps, 7);
+
+        timer t;
+        vector<size_t> order (x.size ());
+        iota (order.begin (), order.end (), 0);
+        sort (order.begin (), order.end (),
+            [&](const auto &a, const auto &b)
+            { return x[a] < x[b]; });
+        t.stop ();
+        const double sort_ms = t.elapsed_ms ();
+
+        t.start ();
+        const auto order2 = ordering::get_order (x.size (), [&] (const size_t i) { return x[i]; });
+        t.stop ();
+        VERIFY (order2.empty () == (swaps == 0));
+
+        clog << total << " points, " << swaps << " swaps"
+            << "\tstd::sort " << sort_ms << "ms"
+            << "\tget_order " << t.elapsed_ms () << "ms" << endl;
+    }
+}
+
+int main ()
+{
+    try
+    {
+        test_radix_key ();
+        test_get_order ();
+        test_gather_scatter ();
+        benchmark_get_order ();
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
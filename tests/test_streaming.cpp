@@ -0,0 +1,107 @@
+#include "coastnet.h"
+#include "streaming.h"
+#include "tree_ensemble.h"
+#include "verify.h"
+#include "test_utils.h"
+
+using namespace std;
+using namespace ATL24_coastnet;
+
+void test_streaming (const string &fn)
+{
+    const bool verbose = false;
+
+    xgboost::tree_ensemble te (verbose);
+    te.load_model (fn);
+
+    // Classify the whole granule at once
+    const auto q = get_points (20000, 654);
+    classify_params cp;
+    cp.threads = 2;
+    cp.cache = true;
+    const auto c = classify (verbose, q, te, cp);
+
+    // Classifying in chunks should give the same results, including
+    // chunks that are smaller than the halos
+    for (auto chunk_size : {size_t (1), size_t (37), size_t (1000), size_t (7777), q.size ()})
+    {
+        streaming::stream_params sp;
+        sp.chunk_size = chunk_size;
+
+        vector<classified_point2d> d;
+        auto write_chunk = [&] (const auto &r)
+        {
+            VERIFY (r.size () <= chunk_size);
+            for (size_t i = 0; i < r.size (); ++i)
+                d.push_back (r[i]);
+        };
+        streaming::classify (verbose, streaming::container_source (q), write_chunk, te, cp, sp);
+        VERIFY (d == c);
+
+        // The chunks and their halos fit, unless a chunk is one point
+        const streaming::container_source source (q);
+        const double halo = 50.0;
+        const auto bounds = streaming::detail::get_chunk_bounds (source, chunk_size, halo);
+        VERIFY (bounds.front () == 0);
+        VERIFY (bounds.back () == q.size ());
+        for (size_t k = 0; k + 1 < bounds.size (); ++k)
+        {
+            VERIFY (bounds[k] < bounds[k + 1]);
+            const auto [halo_begin, halo_end] = streaming::detail::get_halo (source, bounds[k], bounds[k + 1], halo);
+            VERIFY (halo_end - halo_begin <= chunk_size || bounds[k + 1] == bounds[k] + 1);
+        }
+    }
+
+    // The points must be sorted
+    auto r = q;
+    swap (r[5000].x, r[5001].x);
+    bool failed = false;
+    try { streaming::classify (verbose, streaming::container_source (r), [] (const auto &) { }, te, cp); }
+    catch (const exception &) { failed = true; }
+    VERIFY (failed);
+}
+
+void test_chunk_size ()
+{
+    classify_params cp;
+    cp.threads = 2;
+
+    // More memory gives bigger chunks
+    const size_t n = 1'000'000;
+    const size_t small = streaming::get_chunk_size (64 << 20, n, cp);
+    const size_t large = streaming::get_chunk_size (128 << 20, n, cp);
+    VERIFY (small > 1);
+    VERIFY (large > small);
+
+    // The fixed costs come out of the budget
+    VERIFY (streaming::get_chunk_size (64 << 20, 2 * n, cp) < small);
+    VERIFY (streaming::get_chunk_size (64 << 20, n, classify_params ()) > small);
+    cp.cache = true;
+    VERIFY (streaming::get_chunk_size (64 << 20, n, cp) < small);
+
+    // A budget that doesn't cover them is an error
+    bool failed = false;
+    try { streaming::get_chunk_size (1 << 20, n, cp); }
+    catch (const exception &) { failed = true; }
+    VERIFY (failed);
+}
+
+int main ()
+{
+    try
+    {
+        test_chunk_size ();
+
+        const temp_directory dir;
+        const string fn (dir / "model.json");
+        train_model (fn);
+        test_streaming (fn);
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
@@ -0,0 +1,239 @@
+#include "coastnet.h"
+#include "quickscorer.h"
+#include "timer.h"
+#include "tree_ensemble.h"
+#include "verify.h"
+#include "test_utils.h"
+
+using namespace std;
+using namespace ATL24_coastnet;
+using ATL24_coastnet::timer;
+
+void test_small_model ()
+{
+    // Two classes, one tree per class, with a lopsided tree that has to
+    // be padded, and a base score per class
+    const string model = R"({"learner": {
+        "gradient_booster": {"name": "gbtree", "model": {
+            "tree_info": [0, 1],
+            "trees": [
+                {"left_children": [1, -1, 3, -1, -1],
+                 "right_children": [2, -1, 4, -1, -1],
+                 "split_indices": [0, 0, 1, 0, 0],
+                 "split_conditions": [5E-1, -1E0, 1.5E0, 2E0, 3E0],
+                 "default_left": [1, 0, 0, 0, 0]},
+                {"left_children": [-1],
+                 "right_children": [-1],
+                 "split_indices": [0],
+                 "split_conditions": [2.5E0],
+                 "default_left": [0]}
+            ]}},
+        "learner_model_param": {"base_score": "[5E-1,0E0]", "num_class": "2", "num_feature": "2"}}})";
+
+    xgboost::tree_ensemble te (false);
+    te.load_model (json::parse (model));
+
+    VERIFY (te.classes () == 2);
+    VERIFY (te.trees () == 2);
+    VERIFY (te.get_depth () == 2);
+
+    // Class 0 margins are 0.5 + (-1, 2, 3), class 1 margin is 2.5
+    const float nan = numeric_limits<float>::quiet_NaN ();
+    const vector<float> f {
+        0.0f, 0.0f, // left leaf: -0.5 < 2.5
+        1.0f, 1.0f, // right, left: 2.5 == 2.5, first max wins
+        1.0f, 2.0f, // right, right: 3.5 > 2.5
+        nan, 2.0f, // missing goes left
+        1.0f, nan, // missing goes right
+    };
+    const auto pred = te.predict (f, 5, 2);
+    VERIFY (pred == vector<uint32_t> ({1, 0, 0, 1, 0}));
+}
+
+void test_xgbooster (const string &fn)
+{
+    const bool verbose = false;
+    const size_t cols = FEATURES_PER_SAMPLE;
+
+    xgboost::xgbooster xgb (verbose);
+    xgb.load_model (fn);
+    xgboost::tree_ensemble te (verbose);
+    te.load_model (fn);
+    xgboost::quickscorer qs (verbose);
+    qs.load_model (fn);
+
+    // Predict using points that were not used for training
+    const auto q = get_points (3000, 456);
+    vector<float> g;
+    create_features (q, 0, q.size (), g);
+
+    // The dense predictions should match
+    const auto pred = xgb.predict (g, q.size (), cols);
+    VERIFY (te.predict (g, q.size (), cols) == pred);
+    VERIFY (qs.predict (g, q.size (), cols) == pred);
+
+    // So should the sparse predictions
+    xgboost::sparse_features sf;
+    create_features (q, 0, q.size (), sf);
+    xgb.enable_sparse_features ();
+    VERIFY (xgb.predict (sf, cols) == pred);
+    VERIFY (te.predict (sf, cols) == pred);
+    VERIFY (qs.predict (sf, cols) == pred);
+
+    // And so should the classifications
+    classify_params cp;
+    cp.threads = 2;
+    const auto c = classify (verbose, q, xgb, cp);
+    VERIFY (classify (verbose, q, te, cp) == c);
+    VERIFY (classify (verbose, q, qs, cp) == c);
+    cp.predictor = "native";
+    VERIFY (classify (verbose, q, fn, cp) == c);
+    cp.predictor = "quickscorer";
+    VERIFY (classify (verbose, q, fn, cp) == c);
+}
+
+void test_missing_elevation (const string &fn)
+{
+    const size_t cols = FEATURES_PER_SAMPLE;
+
+    xgboost::xgbooster xgb (false);
+    xgb.load_model (fn);
+    xgboost::tree_ensemble te (false);
+    te.load_model (fn);
+    xgboost::quickscorer qs (false);
+    qs.load_model (fn);
+
+    // Missing elevations take the default branches
+    const auto q = get_points (1000, 789);
+    vector<float> g;
+    create_features (q, 0, q.size (), g);
+    for (size_t i = 0; i < q.size (); i += 3)
+        g[i * cols] = numeric_limits<float>::quiet_NaN ();
+
+    const auto pred = xgb.predict (g, q.size (), cols);
+    VERIFY (te.predict (g, q.size (), cols) == pred);
+    VERIFY (qs.predict (g, q.size (), cols) == pred);
+}
+
+void test_prediction_cache (const string &fn)
+{
+    const bool verbose = false;
+
+    xgboost::xgbooster xgb (verbose);
+    xgb.load_model (fn);
+    xgboost::tree_ensemble te (verbose);
+    te.load_model (fn);
+
+    // Some of the points are stacked, so their patches repeat
+    auto q = get_points (5000, 321);
+    for (size_t i = 1; i < q.size (); i += 2)
+        q[i].x = q[i - 1].x;
+
+    // The cache should not change the classifications
+    for (auto sparse : {false, true})
+    {
+        if (sparse)
+            xgb.enable_sparse_features ();
+
+        classify_params cp;
+        cp.sparse = sparse;
+        cp.threads = 4;
+        const auto c = classify (verbose, q, xgb, cp);
+        cp.cache = true;
+        VERIFY (classify (verbose, q, xgb, cp) == c);
+        VERIFY (classify (verbose, q, te, cp) == c);
+        cp.cache_entries = 100;
+        VERIFY (classify (verbose, q, te, cp) == c);
+    }
+
+    // Patches in the same elevation bin get the same key
+    prediction_cache<5> cache ({ -1.0f, 2.0f });
+    const vector<float> cells { 0.0f, 1.0f, 2.0f, 0.0f, 1.0f, 2.0f };
+    VERIFY (cache.get_key (0.0f, &cells[0]) == cache.get_key (1.9f, &cells[0]));
+    VERIFY (cache.get_key (0.0f, &cells[0]) != cache.get_key (2.0f, &cells[0]));
+    VERIFY (cache.get_key (0.0f, &cells[0]) != cache.get_key (0.0f, &cells[1]));
+
+    uint32_t prediction = 0;
+    const auto key = cache.get_key (0.0f, &cells[0]);
+    VERIFY (!cache.find (key, prediction));
+    cache.update (key, 3);
+    VERIFY (cache.find (key, prediction));
+    VERIFY (prediction == 3);
+    VERIFY (cache.size () == 1);
+
+    // A full cache does not save new predictions
+    prediction_cache<5> full ({ -1.0f, 2.0f }, 0);
+    full.update (key, 3);
+    VERIFY (!full.find (key, prediction));
+    VERIFY (full.size () == 0);
+}
+
+template<typename T>
+void benchmark (const string &name, const T &predictor, const vector<float> &f, const xgboost::sparse_features &sf)
+{
+    const size_t cols = FEATURES_PER_SAMPLE;
+    const size_t rows = sf.rows ();
+
+    timer t;
+    const auto q = predictor.predict (f, rows, cols);
+    t.stop ();
+    const double dense_ms = t.elapsed_ms ();
+
+    t.start ();
+    const auto r = predictor.predict (sf, cols);
+    t.stop ();
+    const double sparse_ms = t.elapsed_ms ();
+    VERIFY (q == r);
+
+    clog << name
+        << "\tdense " << dense_ms << "ms (" << (dense_ms == 0 ? 0.0 : 1000.0 * rows / dense_ms) << " rows/sec)"
+        << "\tsparse " << sparse_ms << "ms (" << (sparse_ms == 0 ? 0.0 : 1000.0 * rows / sparse_ms) << " rows/sec)"
+        << endl;
+}
+
+void benchmark_predictors (const string &fn)
+{
+    const bool verbose = false;
+
+    xgboost::xgbooster xgb (verbose);
+    xgb.load_model (fn);
+    xgb.enable_sparse_features ();
+    xgboost::tree_ensemble te (verbose);
+    te.load_model (fn);
+    xgboost::quickscorer qs (verbose);
+    qs.load_model (fn);
+
+    const auto p = get_points (20000, 1234);
+    vector<float> f;
+    create_features (p, 0, p.size (), f);
+    xgboost::sparse_features sf;
+    create_features (p, 0, p.size (), sf);
+
+    clog << "Predicting " << p.size () << " rows" << endl;
+    benchmark ("xgboost", xgb, f, sf);
+    benchmark ("native", te, f, sf);
+    benchmark ("quickscorer", qs, f, sf);
+}
+
+int main ()
+{
+    try
+    {
+        test_small_model ();
+
+        const temp_directory dir;
+        const string fn (dir / "model.json");
+        train_model (fn);
+        test_xgbooster (fn);
+        test_missing_elevation (fn);
+        test_prediction_cache (fn);
+        benchmark_predictors (fn);
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "coastnet.h"
+#include "xgboost.h"
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+// Random points along a track
+inline std::vector<ATL24_coastnet::classified_point2d> get_points (const size_t total, const unsigned seed)
+{
+    using namespace std;
+
+    mt19937 rng (seed);
+    uniform_real_distribution<double> dx (0.0, 0.3);
+    uniform_real_distribution<double> dz (-40.0, 10.0);
+
+    vector<ATL24_coastnet::classified_point2d> p (total);
+    double x = 1000.0;
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        x += dx (rng);
+        p[i].h5_index = i;
+        p[i].x = x;
+        p[i].z = dz (rng);
+    }
+    return p;
+}
+
+// Label points by elevation
+inline std::vector<uint32_t> get_labels (const std::vector<ATL24_coastnet::classified_point2d> &p)
+{
+    std::vector<uint32_t> labels (p.size ());
+    for (size_t i = 0; i < p.size (); ++i)
+        labels[i] = p[i].z < -20.0 ? 1 : (p[i].z < -5.0 ? 2 : 0);
+    return labels;
+}
+
+// Train a small model and save it to 'fn'
+inline void train_model (const std::string &fn)
+{
+    using namespace std;
+    using namespace ATL24_coastnet;
+
+    // Featurize some points
+    const auto p = get_points (5000, 123);
+    const size_t rows = p.size ();
+    const size_t cols = FEATURES_PER_SAMPLE;
+    vector<float> f;
+    create_features (p, 0, rows, f);
+
+    xgboost::xgbooster xgb (false);
+    xgb.train (f, get_labels (p), rows, cols, 10, false);
+    xgb.save_model (fn);
+}
+
+// A directory for a test's files
+//
+// Tests run in parallel from the same directory, so each one writes its
+// files into its own directory, which is removed, along with everything
+// in it, on the way out.
+struct temp_directory
+{
+    std::filesystem::path path;
+    temp_directory ()
+    {
+        std::random_device rng;
+        path = std::filesystem::temp_directory_path ()
+            / ("ATL24_coastnet_test_" + std::to_string (rng ()));
+        std::filesystem::create_directory (path);
+    }
+    ~temp_directory ()
+    {
+        std::error_code ec;
+        std::filesystem::remove_all (path, ec);
+    }
+    temp_directory (const temp_directory &) = delete;
+    temp_directory &operator= (const temp_directory &) = delete;
+
+    // The name of a file in the directory
+    std::string operator/ (const std::string &name) const
+    {
+        return (path / name).string ();
+    }
+};
@@ -0,0 +1,135 @@
+#include "coastnet.h"
+#include "tree_ensemble.h"
+#include "xgboost.h"
+#include "verify.h"
+#include "test_utils.h"
+
+using namespace std;
+using namespace ATL24_coastnet;
+
+// Train a model from batches of features
+void test_train_in_batches (const temp_directory &dir)
+{
+    const bool verbose = false;
+    const size_t cols = FEATURES_PER_SAMPLE;
+    const string fn (dir / "batches.json");
+    const string cache_prefix (dir / "cache");
+
+    const auto p = get_points (5000, 123);
+    const auto labels = get_labels (p);
+
+    // Every sample should be asked for exactly once per pass over the
+    // batches
+    vector<size_t> requests (p.size ());
+    auto get_features = [&] (const size_t begin, const size_t end, float *f)
+    {
+        VERIFY (end - begin <= 1000);
+        vector<float> g;
+        create_features (p, begin, end, g);
+        copy (g.begin (), g.end (), f);
+        for (size_t i = begin; i < end; ++i)
+            ++requests[i];
+    };
+
+    xgboost::xgbooster xgb (verbose);
+    xgb.train_in_batches (get_features, labels, cols, cache_prefix, 1000, 10, false);
+    xgb.save_model (fn);
+    VERIFY (requests[0] != 0);
+    VERIFY (count (requests.begin (), requests.end (), requests[0]) == ptrdiff_t (requests.size ()));
+
+    // The model should work like any other
+    xgboost::tree_ensemble te (verbose);
+    te.load_model (fn);
+    const auto q = get_points (1000, 456);
+    vector<float> g;
+    create_features (q, 0, q.size (), g);
+    VERIFY (te.predict (g, q.size (), cols) == xgb.predict (g, q.size (), cols));
+
+    // Errors in the callback should reach the caller
+    bool failed = false;
+    try
+    {
+        xgboost::xgbooster xgb2 (verbose);
+        xgb2.train_in_batches ([] (size_t, size_t, float *) { throw runtime_error ("no features"); },
+            labels, cols, cache_prefix, 1000, 1, false);
+    }
+    catch (const exception &)
+    {
+        failed = true;
+    }
+    VERIFY (failed);
+}
+
+// Train a model from the byte patches
+void test_train_from_patches (const temp_directory &dir)
+{
+    const bool verbose = false;
+    const size_t cols = FEATURES_PER_SAMPLE;
+    const size_t cells = cols - 1;
+    const size_t pitch = cells + 5;
+
+    const auto p = get_points (3000, 321);
+    const auto labels = get_labels (p);
+    vector<float> g;
+    create_features (p, 0, p.size (), g);
+
+    // Split the features into elevations and padded byte patches
+    vector<float> elevations (p.size ());
+    vector<uint8_t> patches (p.size () * pitch, 99);
+    for (size_t i = 0; i < p.size (); ++i)
+    {
+        elevations[i] = g[i * cols];
+        for (size_t j = 0; j < cells; ++j)
+            patches[i * pitch + j] = g[i * cols + 1 + j];
+    }
+    const xgboost::patch_features f { p.size (), elevations.data (), patches.data (), cells, pitch };
+    VERIFY (f.cols () == cols);
+
+    // Training on the patches should be the same as training on the
+    // float features
+    xgboost::xgbooster xgb1 (verbose);
+    xgb1.train (g, labels, p.size (), cols, 5, false);
+    xgboost::xgbooster xgb2 (verbose);
+    xgb2.train (f, labels, 5, false);
+
+    const auto q = get_points (1000, 654);
+    vector<float> h;
+    create_features (q, 0, q.size (), h);
+    VERIFY (xgb1.predict (h, q.size (), cols) == xgb2.predict (h, q.size (), cols));
+
+    // Histogram training on the CPU should not depend on the number of
+    // threads, and its model should work like any other
+    const string fn (dir / "hist.json");
+    xgboost::hist_params hp;
+    hp.threads = 1;
+    xgboost::xgbooster xgb3 (verbose);
+    xgb3.train_hist (f, labels, 700, 5, hp);
+    hp.threads = 2;
+    xgboost::xgbooster xgb4 (verbose);
+    xgb4.train_hist (f, labels, 700, 5, hp);
+    xgb4.save_model (fn);
+    VERIFY (xgb3.predict (h, q.size (), cols) == xgb4.predict (h, q.size (), cols));
+
+    xgboost::tree_ensemble te (verbose);
+    te.load_model (fn);
+    VERIFY (te.predict (h, q.size (), cols) == xgb4.predict (h, q.size (), cols));
+}
+
+int main ()
+{
+    try
+    {
+        // The models and the external memory caches are written here
+        const temp_directory dir;
+
+        test_train_in_batches (dir);
+        test_train_from_patches (dir);
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}